@@ -40,13 +40,19 @@ namespace Hap
 		"setupCode",
 		"port",
 		"keys",
+		"srp",
 		"pairings",
 		"db"
 	};
 
-	uint8_t Pairings::Count(Controller::Perm perm)
+	uint16_t Pairings::Count(Controller::Perm perm)
 	{
-		uint8_t cnt = 0;
+		std::lock_guard<std::mutex> lock(_mtx);
+
+		if (perm == Controller::None)
+			return _count;
+
+		uint16_t cnt = 0;
 		for (unsigned i = 0; i < sizeofarr(_db); i++)
 		{
 			Controller* ios = &_db[i];
@@ -54,7 +60,7 @@ namespace Hap
 			if (ios->perm == Controller::None)
 				continue;
 
-			if (perm == Controller::None || perm == ios->perm)
+			if (perm == ios->perm)
 				cnt++;
 		}
 
@@ -63,6 +69,18 @@ namespace Hap
 
 	bool Pairings::Add(const uint8_t* id, size_t id_len, const uint8_t* key, Controller::Perm perm)
 	{
+		std::lock_guard<std::mutex> lock(_mtx);
+
+		if (id_len > Controller::IdLen)
+			id_len = Controller::IdLen;
+
+		if (find(id, id_len) >= 0)
+		{
+			// Id matches, TODO
+
+			return true;
+		}
+
 		for (unsigned i = 0; i < sizeofarr(_db); i++)
 		{
 			Controller* rec = &_db[i];
@@ -70,16 +88,14 @@ namespace Hap
 			{
 				// add new record
 				memset(rec->id, 0, Controller::IdLen);
-				rec->idLen = uint8_t(id_len > Controller::IdLen ? Controller::IdLen : id_len);
+				rec->idLen = uint8_t(id_len);
 				memcpy(rec->id, id, rec->idLen);
 				memcpy(rec->key, key, Controller::KeyLen);
 				rec->perm = perm;
 
-				return true;
-			}
-			else if (memcmp(rec->id, id, id_len) == 0)
-			{
-				// Id matches, TODO
+				insert(i);
+				_count++;
+				_ver++;
 
 				return true;
 			}
@@ -107,66 +123,90 @@ namespace Hap
 
 	bool Pairings::Update(const Hap::Tlv::Item& id, Controller::Perm perm)
 	{
+		std::lock_guard<std::mutex> lock(_mtx);
+
 		if (id.len() > Controller::IdLen)
 			return false;
 
-		for (unsigned i = 0; i < sizeofarr(_db); i++)
-		{
-			Controller* ios = &_db[i];
-
-			if (ios->perm == Controller::None)	// empty record
-				continue;
-
-			if (memcmp(ios->id, id.val(), id.len()) == 0)
-			{
-				ios->perm = perm;
-				return true;
-			}
-		}
+		int i = find(id.val(), id.len());
+		if (i < 0)
+			return false;
 
-		return false;
+		_db[_index[i]].perm = perm;
+		_ver++;
+		return true;
 	}
 
 	bool Pairings::Remove(const Hap::Tlv::Item& id)
 	{
+		std::lock_guard<std::mutex> lock(_mtx);
+
 		if (id.len() > Controller::IdLen)
 			return false;
 
-		for (unsigned i = 0; i < sizeofarr(_db); i++)
+		int i = find(id.val(), id.len());
+		if (i >= 0)
 		{
-			Controller* ios = &_db[i];
-
-			if (memcmp(ios->id, id.val(), id.len()) == 0)
-			{
-				ios->perm = Controller::None;	// mark record empty
-				return true;
-			}
+			_db[_index[i]].perm = Controller::None;	// mark record empty
+			_index[i] = IndexDeleted;
+			_count--;
+			_deleted++;
+			_ver++;
+
+			// too many deleted slots make probe sequences long
+			if (_deleted > IndexSize / 4)
+				rebuild();
 		}
 
 		return true;
 	}
 
-	const Controller* Pairings::Get(const Hap::Tlv::Item& id)
+	bool Pairings::Get(const Hap::Tlv::Item& id, Controller& ios)
 	{
+		std::lock_guard<std::mutex> lock(_mtx);
+
 		if (id.len() > Controller::IdLen)
-			return nullptr;
+			return false;
 
-		for (unsigned i = 0; i < sizeofarr(_db); i++)
-		{
-			Controller* ios = &_db[i];
+		int i = find(id.val(), id.len());
+		if (i < 0)
+			return false;
 
-			if (ios->perm == Controller::None)	// empty record
-				continue;
+		ios = _db[_index[i]];	// copy under the lock, record may be reused once it is released
+		return true;
+	}
+
+	uint16_t Pairings::Count(uint32_t& ver)
+	{
+		std::lock_guard<std::mutex> lock(_mtx);
+
+		ver = _ver;
+		return _count;
+	}
+
+	bool Pairings::Next(uint16_t& pos, Controller& ios, uint32_t ver)
+	{
+		std::lock_guard<std::mutex> lock(_mtx);
 
-			if (memcmp(ios->id, id.val(), id.len()) == 0)
-				return ios;
+		if (ver != _ver)
+			return false;
+
+		for (; pos < sizeofarr(_db); pos++)
+		{
+			if (_db[pos].perm != Controller::None)
+			{
+				ios = _db[pos++];	// copy under the lock, as in Get
+				return true;
+			}
 		}
 
-		return nullptr;
+		return false;
 	}
 
 	bool Pairings::forEach(std::function<bool(const Controller*)> cb)
 	{
+		std::lock_guard<std::mutex> lock(_mtx);
+
 		for (unsigned i = 0; i < sizeofarr(_db); i++)
 		{
 			Controller* ios = &_db[i];
@@ -183,11 +223,420 @@ namespace Hap
 
 	void Pairings::init()		// Init pairings - destroy all existing records
 	{
+		std::lock_guard<std::mutex> lock(_mtx);
+
 		for (unsigned i = 0; i < sizeofarr(_db); i++)
 		{
 			Controller* ios = &_db[i];
 
 			ios->perm = Controller::None;
 		}
+
+		for (unsigned i = 0; i < sizeofarr(_index); i++)
+			_index[i] = IndexFree;
+
+		_count = 0;
+		_deleted = 0;
+		_ver++;
+	}
+
+	// FNV-1a hash of controller ID
+	uint32_t Pairings::hash(const uint8_t* id, size_t id_len)
+	{
+		uint32_t h = 2166136261u;
+
+		for (size_t i = 0; i < id_len; i++)
+		{
+			h ^= id[i];
+			h *= 16777619u;
+		}
+
+		return h;
+	}
+
+	int Pairings::find(const uint8_t* id, size_t id_len)
+	{
+		uint16_t i = hash(id, id_len) & (IndexSize - 1);
+
+		for (unsigned n = 0; n < IndexSize; n++, i = (i + 1) & (IndexSize - 1))
+		{
+			uint16_t r = _index[i];
+
+			if (r == IndexFree)		// end of probe sequence
+				return -1;
+
+			if (r == IndexDeleted)
+				continue;
+
+			const Controller* rec = &_db[r];
+			if (rec->idLen == id_len && memcmp(rec->id, id, id_len) == 0)
+				return i;
+		}
+
+		return -1;
+	}
+
+	void Pairings::insert(uint16_t rec)
+	{
+		uint16_t i = hash(_db[rec].id, _db[rec].idLen) & (IndexSize - 1);
+
+		// the index is always at least half empty so free slot is found
+		while (_index[i] != IndexFree && _index[i] != IndexDeleted)
+			i = (i + 1) & (IndexSize - 1);
+
+		if (_index[i] == IndexDeleted)
+			_deleted--;
+
+		_index[i] = rec;
+	}
+
+	void Pairings::rebuild()
+	{
+		for (unsigned i = 0; i < sizeofarr(_index); i++)
+			_index[i] = IndexFree;
+
+		_deleted = 0;
+
+		for (uint16_t r = 0; r < sizeofarr(_db); r++)
+		{
+			if (_db[r].perm != Controller::None)
+				insert(r);
+		}
+	}
+
+	void Log(const char* f, ...)
+	{
+		va_list arg;
+		va_start(arg, f);
+		Logger::Instance().Text(f, arg);
+		va_end(arg);
+	}
+
+	void Hex(const char* Header, const void* Buffer, size_t Length)
+	{
+		Logger::Instance().Hex(Header, Buffer, Length);
+	}
+
+	void Logger::Start()
+	{
+		std::lock_guard<std::mutex> lock(_mtx);
+
+		if (_run)
+			return;
+
+		_run = true;
+		_thread = std::thread(&Logger::_writer, this);
+	}
+
+	void Logger::Stop()
+	{
+		{
+			std::lock_guard<std::mutex> lock(_mtx);
+
+			if (!_run)
+				return;
+
+			_run = false;
+		}
+
+		_cv.notify_all();
+		_thread.join();
+
+		// producers which saw _run set may still commit, wait for them
+		//	new ones see _run cleared and print directly
+		while (_busy.load() != 0)
+			std::this_thread::yield();
+
+		// records put while the writer was exiting
+		_drain();
+	}
+
+	void Logger::Text(const char* f, va_list arg)
+	{
+		_busy++;	// before checking _run, so Stop either waits for this record or it goes to stdout
+
+		Ring* r = _run ? _own() : nullptr;
+
+		if (r == nullptr)
+		{
+			_busy--;
+			vprintf(f, arg);
+			return;
+		}
+
+		// arguments may point to buffers reused right after the call, so format now
+		char t[MaxText];
+		int l = vsnprintf(t, sizeof(t), f, arg);
+
+		if (l >= 0)
+		{
+			if (l >= (int)sizeof(t))
+				l = sizeof(t) - 1;
+
+			Rec* rec = _reserve(r, l + 1);
+			if (rec != nullptr)
+			{
+				memcpy(rec + 1, t, l + 1);
+				_commit(r, rec, TextRec);
+			}
+		}
+
+		_busy--;
+	}
+
+	void Logger::Hex(const char* hdr, const void* buf, size_t len)
+	{
+		_busy++;	// same as in Text
+
+		Ring* r = _run ? _own() : nullptr;
+
+		if (r == nullptr)
+		{
+			_busy--;
+			_hex(hdr, buf, (const uint8_t*)buf, len, len);
+			return;
+		}
+
+		size_t hlen = strlen(hdr) + 1;
+		size_t dlen = len < MaxHex ? len : MaxHex;
+
+		Rec* rec = _reserve(r, sizeof(HexInfo) + dlen + hlen);
+		if (rec != nullptr)
+		{
+			HexInfo* h = (HexInfo*)(rec + 1);
+			h->addr = buf;
+			h->len = (uint32_t)len;
+			h->dlen = (uint32_t)dlen;
+
+			uint8_t* p = (uint8_t*)(h + 1);
+			memcpy(p, buf, dlen);
+			memcpy(p + dlen, hdr, hlen);
+
+			_commit(r, rec, HexRec);
+		}
+
+		_busy--;
+	}
+
+	Logger::Ring* Logger::_own()
+	{
+		// the ring is released when its thread exits
+		struct Owner
+		{
+			Ring* ring = nullptr;
+			bool none = false;
+
+			~Owner()
+			{
+				if (ring != nullptr)
+					ring->owned.store(false, std::memory_order_release);
+			}
+		};
+		static thread_local Owner own;
+
+		if (own.ring == nullptr && !own.none)
+		{
+			for (auto& r : _ring)
+			{
+				bool owned = false;
+				if (r.owned.compare_exchange_strong(owned, true, std::memory_order_acquire))
+				{
+					own.ring = &r;
+					break;
+				}
+			}
+
+			own.none = own.ring == nullptr;
+		}
+
+		return own.ring;
+	}
+
+	Logger::Rec* Logger::_reserve(Ring* r, size_t len)
+	{
+		uint32_t size = (sizeof(Rec) + len + 7) & ~7;
+
+		if (size > RingSize / 2)
+		{
+			_dropped.fetch_add(1, std::memory_order_relaxed);
+			return nullptr;
+		}
+
+		uint32_t head = r->head.load(std::memory_order_relaxed);
+		uint32_t tail = r->tail.load(std::memory_order_acquire);
+		uint32_t pos = head & (RingSize - 1);
+		uint32_t room = RingSize - pos;		// contiguous space up to the ring end, at least sizeof(Rec)
+
+		// record is always contiguous, the ring end is skipped if it does not fit
+		if (RingSize - (head - tail) < (room < size ? room + size : size))
+		{
+			_dropped.fetch_add(1, std::memory_order_relaxed);
+			return nullptr;
+		}
+
+		if (room < size)
+		{
+			Rec* skip = (Rec*)(r->buf + pos);
+			skip->size = (uint16_t)room;
+			skip->type = Skip;
+
+			head += room;
+			pos = 0;
+		}
+
+		Rec* rec = (Rec*)(r->buf + pos);
+		rec->size = (uint16_t)size;
+		r->next = head + size;
+
+		return rec;
+	}
+
+	void Logger::_commit(Ring* r, Rec* rec, Type type)
+	{
+		bool empty = r->head.load(std::memory_order_relaxed) == r->tail.load(std::memory_order_relaxed);
+
+		rec->type = type;
+		rec->seq = _seq.fetch_add(1, std::memory_order_relaxed);
+		r->head.store(r->next, std::memory_order_release);
+
+		// wake the writer only on the first record, it drains all rings before waiting
+		if (empty)
+			_cv.notify_one();
+	}
+
+	bool Logger::_drain()
+	{
+		bool any = false;
+
+		for (;;)
+		{
+			// find the oldest record among the rings
+			Ring* next = nullptr;
+			Rec* rec = nullptr;
+
+			for (auto& r : _ring)
+			{
+				uint32_t tail = r.tail.load(std::memory_order_relaxed);
+				uint32_t head = r.head.load(std::memory_order_acquire);
+
+				if (tail != head)
+				{
+					Rec* p = (Rec*)(r.buf + (tail & (RingSize - 1)));
+
+					if (p->type == Skip)
+					{
+						r.tail.store(tail + p->size, std::memory_order_release);
+
+						tail += p->size;
+						if (tail == head)
+							continue;
+
+						p = (Rec*)(r.buf + (tail & (RingSize - 1)));
+					}
+
+					if (rec == nullptr || (int32_t)(p->seq - rec->seq) < 0)
+					{
+						next = &r;
+						rec = p;
+					}
+				}
+			}
+
+			if (rec == nullptr)
+				break;
+
+			if (rec->type == TextRec)
+			{
+				fputs((const char*)(rec + 1), stdout);
+			}
+			else if (rec->type == HexRec)
+			{
+				const HexInfo* h = (const HexInfo*)(rec + 1);
+				const uint8_t* data = (const uint8_t*)(h + 1);
+
+				_hex((const char*)(data + h->dlen), h->addr, data, h->dlen, h->len);
+			}
+
+			next->tail.fetch_add(rec->size, std::memory_order_release);
+			any = true;
+		}
+
+		uint32_t dropped = _dropped.exchange(0, std::memory_order_relaxed);
+		if (dropped != 0)
+			printf("Log: %u records dropped\n", dropped);
+
+		if (any || dropped != 0)
+			fflush(stdout);
+
+		return any;
+	}
+
+	void Logger::_writer()
+	{
+		std::unique_lock<std::mutex> lock(_mtx);
+
+		while (_run)
+		{
+			lock.unlock();
+			bool any = _drain();
+			lock.lock();
+
+			// notify from Log may come between the drain and the wait, so wait is limited
+			if (!any && _run)
+				_cv.wait_for(lock, std::chrono::milliseconds(Idle));
+		}
+	}
+
+	void Logger::_hex(const char* hdr, const void* addr, const uint8_t* data, size_t dlen, size_t len)
+	{
+		static const char hex[] = "0123456789ABCDEF";
+		const uint8_t* a = data;
+		size_t i;
+		size_t max = 16;
+
+		printf("%s addr %p size 0x%X(%d):\n", hdr, addr, (unsigned)len, (unsigned)len);
+
+		while (dlen > 0)
+		{
+			char line[52];
+			char *p = line;
+
+			if (dlen < max)
+				max = dlen;
+
+			memset(line, 0, sizeof(line));
+
+			for (i = 0; i < 16; i++)
+			{
+				if (i < max)
+				{
+					*p++ = hex[(a[i] & 0xf0) >> 4];
+					*p++ = hex[a[i] & 0x0f];
+				}
+				else
+				{
+					*p++ = ' ';
+					*p++ = ' ';
+				}
+			}
+
+			*p++ = ' ';
+			*p++ = ' ';
+			*p++ = ' ';
+
+			for (i = 0; i < max; i++)
+			{
+				if (a[i] < 0x20 || a[i] > 0x7e) *p++ = '.';
+				else *p++ = a[i];
+			}
+
+			printf("0x%04lX:%s\n", ((unsigned long)addr + (a - data)) & 0xFFFF, line);
+
+			dlen -= max;
+			a += max;
+		}
+
+		if (len > (size_t)(a - data))
+			printf("...\n");
 	}
 }
@@ -30,9 +30,15 @@ SOFTWARE.
 #include <stdio.h>
 #include <string.h>
 #include <stdint.h>
+#include <stdarg.h>
 
 #include <utility>
 #include <functional>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <chrono>
 
 extern "C" void t_random(unsigned char* data, unsigned size);
 
@@ -45,14 +51,110 @@ namespace Hap
 	void Hex(const char* Header, const void* Buffer, size_t Length);
 	#define Dbg if(debug)Log
 
+	// log levels, calls above HAP_LOG_LEVEL are compiled out
+	//	1 - Log, Hex: errors, connections, pairing steps
+	//	2 - LogDbg, HexDbg: request details (method, path, headers, TLV, DB dumps) and key dumps
+#ifndef HAP_LOG_LEVEL
+#define HAP_LOG_LEVEL 1
+#endif
+#if HAP_LOG_LEVEL >= 2
+	#define LogDbg Log
+	#define HexDbg Hex
+#else
+	#define LogDbg(...) ((void)0)
+	#define HexDbg(...) ((void)0)
+#endif
+
+	// Logger - asynchronous log writer behind Log and Hex
+	//	each thread puts its records into own lock-free ring, background thread writes
+	//	the records of all rings to stdout in sequence order, so Log never waits for the output.
+	//	Hex records keep the raw bytes and are formatted by the writer.
+	//	When the ring is full the record is dropped and counted.
+	//	Before Start, after Stop and in threads left without a ring the records are written synchronously
+	class Logger
+	{
+	public:
+		constexpr static uint32_t RingSize = 8192;		// per-thread ring size, power of 2
+		constexpr static uint8_t MaxRings = 16;			// max threads with own ring
+		constexpr static uint16_t MaxText = 512;		// max length of formatted text record
+		constexpr static uint16_t MaxHex = 1024;		// max data bytes in Hex record
+		constexpr static uint16_t Idle = 100;			// writer wakeup period when idle, ms
+
+		static Logger& Instance()
+		{
+			static Logger logger;
+			return logger;
+		}
+
+		void Start();
+		void Stop();
+
+		void Text(const char* f, va_list arg);
+		void Hex(const char* hdr, const void* buf, size_t len);
+
+	private:
+		enum Type : uint8_t
+		{
+			Skip,			// unused space at the ring end
+			TextRec,		// NUL-terminated text
+			HexRec,			// HexInfo, data bytes, NUL-terminated header
+		};
+
+		struct Rec
+		{
+			uint32_t seq;	// global record sequence number
+			uint16_t size;	// record size including this header, multiple of 8
+			Type type;
+			uint8_t rsv;
+		};
+
+		struct HexInfo
+		{
+			const void* addr;	// original buffer address
+			uint32_t len;		// original buffer length
+			uint32_t dlen;		// data bytes in the record
+		};
+
+		// single producer (owner thread) single consumer (writer) ring
+		struct Ring
+		{
+			alignas(64) std::atomic<uint32_t> head{ 0 };	// bytes written, advanced by the owner
+			uint32_t next = 0;								// head after the reserved record
+			alignas(64) std::atomic<uint32_t> tail{ 0 };	// bytes read, advanced by the writer
+			std::atomic<bool> owned{ false };
+			alignas(8) uint8_t buf[RingSize];
+		};
+
+		Ring _ring[MaxRings];
+		std::atomic<uint32_t> _seq{ 0 };
+		std::atomic<uint32_t> _dropped{ 0 };
+		std::atomic<bool> _run{ false };
+		std::atomic<uint32_t> _busy{ 0 };		// producers in Text/Hex, Stop waits for them before the last drain
+		std::thread _thread;
+		std::mutex _mtx;
+		std::condition_variable _cv;
+
+		Logger() {}
+
+		Ring* _own();		// ring of calling thread, nullptr when all rings are taken
+		Rec* _reserve(Ring* r, size_t len);
+		void _commit(Ring* r, Rec* rec, Type type);
+		bool _drain();		// write all records, returns false when there were none
+		void _writer();
+
+		static void _hex(const char* hdr, const void* addr, const uint8_t* data, size_t dlen, size_t len);
+	};
+
 	// global constants
-	constexpr uint8_t MaxPairings = 10 /*16*/;				// max number of pairings the accessory supports (4.11 Add pairing)
-															//	10 for now, until > 1024 byte frames are supported	TODO: fix
+	constexpr uint16_t MaxPairings = 256;					// max number of pairings the accessory supports (4.11 Add pairing)
 	constexpr uint8_t MaxHttpSessions = 8;					// max HTTP sessions (5.2.3 TCP requirements)
 	constexpr uint8_t MaxHttpHeaders = 20;					// max number of HTTP headers in request
 	constexpr uint8_t MaxHttpTlv = 10;						// max num of items in incoming TLV
 	constexpr uint16_t MaxHttpBlock = 1024;					// max size of encrypted block (5.5.2 Session securiry)
 	constexpr uint16_t MaxHttpFrame = MaxHttpBlock + 2 + 16;// max HTTP frame 
+	constexpr uint8_t MaxEvents = 32;						// max pending event notifications per session
+	constexpr uint8_t MaxResumeSessions = 16;				// max cached Pair Verify sessions for Pair Resume
+	constexpr uint32_t ResumeTtl = 3600;					// default lifetime of cached session, seconds
 
 	constexpr uint16_t DefString = 64;		// default length of a string characteristic
 	constexpr uint16_t MaxString = 64;		// max string length
@@ -152,6 +254,7 @@ namespace Hap
 			key_setup, 
 			key_port, 
 			key_keys, 
+			key_srp,
 			key_pairings,
 			key_db,
 			key_max
@@ -205,6 +308,7 @@ namespace Hap
 #include "HapMdns.h"
 #include "HapJson.h"
 #include "HapTlv.h"
+#include "HapMetrics.h"
 #include "HapHttp.h"
 #include "HapTcp.h"
 #include "HapDb.h"
@@ -214,12 +318,20 @@ namespace Hap
 namespace Hap
 {
 	// pairings DB, persistent across reboots
+	//	records are kept in flat array and located through open-addressing hash index
+	//	on controller ID, so lookup does not depend on number of pairings
+	//	all public methods are thread-safe
 	class Pairings
 	{
 	public:
+		Pairings()
+		{
+			init();
+		}
+
 		// count pairing records with matching Permissions
 		//	in perm == None, cput all records
-		uint8_t Count(Controller::Perm perm = Controller::None);
+		uint16_t Count(Controller::Perm perm = Controller::None);
 
 		// add pairing record, returns false if failed
 		bool Add(const uint8_t* id, size_t id_len, const uint8_t* key, Controller::Perm perm);
@@ -231,8 +343,15 @@ namespace Hap
 		// remove controller
 		bool Remove(const Hap::Tlv::Item& id);
 
-		// get pairing record, returns nullptr if not found
-		const Controller* Get(const Hap::Tlv::Item& id);
+		// copy pairing record out, returns false if not found
+		bool Get(const Hap::Tlv::Item& id, Controller& ios);
+
+		// count all pairing records, ver receives current version of the pairings
+		uint16_t Count(uint32_t& ver);
+
+		// copy out next pairing record at index pos or after it, pos is advanced past the record
+		//	returns false when no records are left, or when the pairings changed since version ver
+		bool Next(uint16_t& pos, Controller& ios, uint32_t ver);
 
 		bool forEach(std::function<bool(const Controller*)> cb);
 
@@ -241,6 +360,23 @@ namespace Hap
 		void init();
 
 		Controller _db[MaxPairings];
+		std::mutex _mtx;
+
+	private:
+		static constexpr uint16_t IndexSize = 512;			// power of two, at least twice MaxPairings
+		static constexpr uint16_t IndexFree = 0xFFFF;		// never used index slot, ends the probe sequence
+		static constexpr uint16_t IndexDeleted = 0xFFFE;	// removed record, probe sequence continues
+		static_assert((IndexSize & (IndexSize - 1)) == 0 && IndexSize >= MaxPairings * 2, "invalid IndexSize");
+
+		uint16_t _index[IndexSize];		// record number, IndexFree or IndexDeleted
+		uint16_t _count;				// number of records
+		uint16_t _deleted;				// number of IndexDeleted slots
+		uint32_t _ver = 0;				// incremented on each change of the records
+
+		static uint32_t hash(const uint8_t* id, size_t id_len);
+		int find(const uint8_t* id, size_t id_len);		// returns index slot, or -1
+		void insert(uint16_t rec);
+		void rebuild();
 	};
 }
 
@@ -24,6 +24,17 @@ SOFTWARE.
 
 #include "Hap.h"
 
+// system entropy source
+#if defined(__linux__)
+#include <errno.h>
+#include <sys/random.h>
+#elif defined(_WIN32)
+#define NOMINMAX
+#include <windows.h>
+#include <bcrypt.h>
+#pragma comment(lib, "bcrypt.lib")
+#endif
+
 // sha2/hmac
 #include "crypt/sha2.c"
 #include "crypt/hmac_sha2.c"
@@ -35,16 +46,28 @@ SOFTWARE.
 typedef unsigned int u_int;
 typedef unsigned char u_char;
 #include "chacha-merged.c"
+#include "chacha20-simd.c"
 
-// poly1305
+// poly1305, 64-bit version when 128-bit multiplication is available
+#if defined(__SIZEOF_INT128__)
+#include "poly1305-donna-64.c"
+#else
 #include "poly1305-donna.c"
+#endif
+
+// field arithmetic shared by curve25519 and ed25519, 64-bit limbs when available
+#include "ed25519_fe.h"
+#ifdef ED25519_FE64
+#include "ed25519_fe64.c"
+#else
+#include "ed25519_fe.c"
+#endif
 
 // curve25519
 #include "curve25519.c"
 
 // ed25519
 typedef sha512_ctx sha512_context;
-#include "ed25519_fe.c"
 #include "ed25519_ge.c"
 #include "ed25519_keypair.c"
 #include "ed25519_sc.c"
@@ -57,59 +80,161 @@ namespace Hap
 {
 	namespace Crypt
 	{
-		void aead(Action action,
-			uint8_t* out,
-			uint8_t* tag,
-			const uint8_t* key,
-			const uint8_t* nonce,
-			const uint8_t* msg,
-			uint16_t msg_size,
-			const uint8_t* aad,
-			uint16_t aad_size
-		)
+		// Poly1305 tag of AEAD construction
+		static void aead_tag(uint8_t* tag, const uint8_t* otk,
+			const uint8_t* aad, size_t aad_size, const uint8_t* data, size_t data_size)
 		{
-			uint8_t otk[64];
-			uint8_t zero[16];
+			static const uint8_t zero[16] = { 0 };
 			union
 			{
 				uint8_t b[8];
 				uint64_t u;
 			} num;
-			size_t l;
-
-			memset(zero, 0, sizeof(zero));
-
-			chacha20_block(otk, key, nonce);
-
-			chacha20_encrypt(out, msg, msg_size, key, nonce);
 
 			poly1305_context ctx;
 			poly1305_init(&ctx, otk);
 			if (aad_size > 0)
 			{
-				l = aad_size;
-				poly1305_update(&ctx, aad, l);
-				if (l % 16)
-					poly1305_update(&ctx, zero, 16 - (l % 16));
+				poly1305_update(&ctx, aad, aad_size);
+				if (aad_size % 16)
+					poly1305_update(&ctx, zero, 16 - (aad_size % 16));
 			}
 
-			l = msg_size;
-			if (action == Encrypt)
-				poly1305_update(&ctx, out, l);
-			else
-				poly1305_update(&ctx, msg, l);
-			if (l % 16)
-				poly1305_update(&ctx, zero, 16 - (l % 16));
+			poly1305_update(&ctx, data, data_size);
+			if (data_size % 16)
+				poly1305_update(&ctx, zero, 16 - (data_size % 16));
 
 			num.u = aad_size;
 			poly1305_update(&ctx, num.b, 8);
 
-			num.u = msg_size;
+			num.u = data_size;
 			poly1305_update(&ctx, num.b, 8);
 
 			poly1305_finish(&ctx, tag);
 		}
 
+		void aead(Action action,
+			uint8_t* out,
+			uint8_t* tag,
+			const uint8_t* key,
+			const uint8_t* nonce,
+			const uint8_t* msg,
+			uint16_t msg_size,
+			const uint8_t* aad,
+			uint16_t aad_size
+		)
+		{
+			uint8_t otk[32];
+
+			// one-time Poly1305 key and encryption in one keystream pass
+			chacha20_aead(out, otk, msg, msg_size, key, nonce);
+
+			aead_tag(tag, otk, aad, aad_size, action == Encrypt ? out : msg, msg_size);
+		}
+
+		// frames are processed in groups, keystream of a group is generated together
+		static constexpr unsigned FrameGroup = 8;
+
+		static void frame_nonce(uint8_t* nonce, uint64_t seq)
+		{
+			memset(nonce, 0, 4);
+			for (int i = 0; i < 8; i++)
+				nonce[4 + i] = uint8_t(seq >> (8 * i));
+		}
+
+		size_t aead_seal_frames(uint8_t* out, const uint8_t* key, uint64_t seq,
+			const uint8_t* msg, size_t size, uint16_t block)
+		{
+			uint8_t* dst[FrameGroup];
+			const uint8_t* src[FrameGroup];
+			size_t len[FrameGroup];
+			uint8_t otk[FrameGroup][32];
+			uint8_t nonce[12];
+			size_t used = 0;
+
+			while (size > 0)
+			{
+				unsigned n;
+
+				for (n = 0; n < FrameGroup && size > 0; n++)
+				{
+					size_t l = size > block ? block : size;
+					uint8_t* b = out + used;
+
+					// data length is frame header and AAD
+					b[0] = l & 0xFF;
+					b[1] = (l >> 8) & 0xFF;
+
+					dst[n] = b + FrameHdr;
+					src[n] = msg;
+					len[n] = l;
+
+					used += FrameHdr + l + TagSize;
+					msg += l;
+					size -= l;
+				}
+
+				frame_nonce(nonce, seq);
+				chacha20_aead_frames(dst, otk, src, len, n, key, nonce);
+
+				for (unsigned i = 0; i < n; i++)
+					aead_tag(dst[i] + len[i], otk[i], dst[i] - FrameHdr, FrameHdr, dst[i], len[i]);
+
+				seq += n;
+			}
+
+			memset(otk, 0, sizeof(otk));
+			return used;
+		}
+
+		int aead_open_frames(uint8_t* out, const uint8_t* key, uint64_t seq,
+			const uint8_t* in, unsigned count)
+		{
+			uint8_t* dst[FrameGroup];
+			const uint8_t* src[FrameGroup];
+			size_t len[FrameGroup];
+			uint8_t otk[FrameGroup][32];
+			uint8_t nonce[12];
+			uint8_t tag[TagSize];
+			int ret = 0;
+
+			while (count > 0)
+			{
+				unsigned n;
+
+				for (n = 0; n < FrameGroup && count > 0; n++, count--)
+				{
+					size_t l = in[0] + ((size_t)(in[1]) << 8);
+
+					src[n] = in + FrameHdr;
+					dst[n] = out + ret;
+					len[n] = l;
+
+					in += FrameHdr + l + TagSize;
+					ret += int(l);
+				}
+
+				frame_nonce(nonce, seq);
+				chacha20_aead_frames(dst, otk, src, len, n, key, nonce);
+
+				for (unsigned i = 0; i < n; i++)
+				{
+					aead_tag(tag, otk[i], src[i] - FrameHdr, FrameHdr, src[i], len[i]);
+					if (memcmp(tag, src[i] + len[i], TagSize) != 0)
+					{
+						ret = -1;
+						count = 0;
+						break;
+					}
+				}
+
+				seq += n;
+			}
+
+			memset(otk, 0, sizeof(otk));
+			return ret;
+		}
+
 		void hkdf(
 			const unsigned char *salt, size_t salt_len,
 			const unsigned char *key, size_t key_len,
@@ -117,35 +242,196 @@ namespace Hap
 			unsigned char *okm, unsigned int okm_len
 		)
 		{
-			unsigned char prk[64];
+			Hkdf(salt, salt_len, key, key_len).expand(info, info_len, okm, okm_len);
+		}
+
+		Hkdf::Salt::Salt(const char* salt)
+		{
+			hmac_sha512_init(&_hmac, (const uint8_t*)salt, (unsigned)strlen(salt));
+		}
+
+		Hkdf::Salt::Salt(const uint8_t* salt, size_t salt_len)
+		{
+			hmac_sha512_init(&_hmac, salt, (unsigned)salt_len);
+		}
+
+		Hkdf::Hkdf(const Salt& salt, const uint8_t* key, size_t key_len)
+		{
+			_extract(salt._hmac, key, key_len);
+		}
+
+		Hkdf::Hkdf(const uint8_t* salt, size_t salt_len, const uint8_t* key, size_t key_len)
+		{
+			Salt s(salt, salt_len);
+			_extract(s._hmac, key, key_len);
+		}
+
+		Hkdf::~Hkdf()
+		{
+			memset(&_prk, 0, sizeof(_prk));
+		}
+
+		void Hkdf::_extract(const hmac_sha512_ctx& salt, const uint8_t* key, size_t key_len)
+		{
+			uint8_t prk[64];
+
+			// PRK = HMAC(salt, key), the salt keyed state is reused
 			hmac_sha512_ctx ctx;
-			uint8_t ctr = 1;
+			ctx.ctx_inside = salt.ctx_inside;
+			ctx.ctx_outside = salt.ctx_outside;
+			hmac_sha512_update(&ctx, key, (unsigned)key_len);
+			hmac_sha512_final(&ctx, prk, sizeof(prk));
+
+			hmac_sha512_init(&_prk, prk, sizeof(prk));
+			memset(prk, 0, sizeof(prk));
+			memset(&ctx.ctx_inside, 0, sizeof(ctx.ctx_inside));
+		}
 
-			hmac_sha512(salt, salt_len, key, key_len, prk, 64);
+		void Hkdf::expand(const char* info, uint8_t* okm, unsigned okm_len) const
+		{
+			expand((const uint8_t*)info, strlen(info), okm, okm_len);
+		}
+
+		void Hkdf::expand(const uint8_t* info, size_t info_len, uint8_t* okm, unsigned okm_len) const
+		{
+			uint8_t t[64];
+			uint8_t ctr = 1;
 
-			hmac_sha512_init(&ctx, prk, 64);
-			hmac_sha512_update(&ctx, info, info_len);
+			// T(1) = HMAC(PRK, info | 0x01), only one block is ever needed by HAP
+			//	final uses only inner and outer hash states, the rest of the context is not copied
+			hmac_sha512_ctx ctx;
+			ctx.ctx_inside = _prk.ctx_inside;
+			ctx.ctx_outside = _prk.ctx_outside;
+			hmac_sha512_update(&ctx, info, (unsigned)info_len);
 			hmac_sha512_update(&ctx, &ctr, 1);
-			hmac_sha512_final(&ctx, prk, 64);
+			hmac_sha512_final(&ctx, t, sizeof(t));
+
+			memcpy(okm, t, okm_len > sizeof(t) ? sizeof(t) : okm_len);
+			memset(t, 0, sizeof(t));
+			memset(&ctx.ctx_inside, 0, sizeof(ctx.ctx_inside));
+		}
 
-			memcpy(okm, prk, okm_len);
+		void Random::Fill(uint8_t* buf, size_t size)
+		{
+			static thread_local State st;
+
+			while (size > 0)
+			{
+				if (st.pos == CacheSize)
+					_refill(st);
+
+				size_t l = CacheSize - st.pos;
+				if (l > size)
+					l = size;
+
+				// served bytes are not kept in the cache
+				memcpy(buf, st.cache + st.pos, l);
+				memset(st.cache + st.pos, 0, l);
+
+				st.pos += uint16_t(l);
+				st.out += uint32_t(l);
+				buf += l;
+				size -= l;
+			}
+		}
+
+		void Random::_refill(State& st)
+		{
+			static const uint8_t nonce[12] = { 0 };
+
+			if (st.out >= ReseedSize)
+			{
+				uint8_t seed[KeySize];
+				bool ok = _entropy(seed, sizeof(seed));
+
+				// unseeded key is public, keep trying until the source delivers
+				if (!ok && !st.seeded)
+				{
+					Log("Random: system entropy source error, waiting for the first seed\n");
+
+					while (!ok)
+					{
+						std::this_thread::sleep_for(std::chrono::milliseconds(100));
+						ok = _entropy(seed, sizeof(seed));
+					}
+				}
+
+				if (ok)
+				{
+					for (unsigned i = 0; i < KeySize; i++)
+						st.key[i] ^= seed[i];
+					st.out = 0;
+					st.seeded = true;
+				}
+				else
+					Log("Random: system entropy source error\n");	// seeded before, retry on next refill
+
+				memset(seed, 0, sizeof(seed));
+			}
+
+			chacha20_keystream(st.cache, CacheSize / 64, st.key, nonce);
+
+			// first bytes of keystream become the next key, so the output
+			//	already served cannot be recovered from the state
+			memcpy(st.key, st.cache, KeySize);
+			memset(st.cache, 0, KeySize);
+			st.pos = KeySize;
+		}
+
+		bool Random::_entropy(uint8_t* buf, size_t size)
+		{
+#if defined(_WIN32)
+			return BCryptGenRandom(NULL, buf, (ULONG)size, BCRYPT_USE_SYSTEM_PREFERRED_RNG) == 0;
+#else
+#if defined(__linux__)
+			while (size > 0)
+			{
+				ssize_t n = getrandom(buf, size, 0);
+				if (n < 0)
+				{
+					if (errno == EINTR)
+						continue;
+					break;
+				}
+				buf += n;
+				size -= n;
+			}
+			if (size == 0)
+				return true;
+#endif
+			// getrandom is not available
+			FILE* f = fopen("/dev/urandom", "rb");
+			if (f == NULL)
+				return false;
+
+			bool ret = fread(buf, 1, size, f) == size;
+			fclose(f);
+
+			return ret;
+#endif
 		}
 
 		void Curve25519::Init()
+		{
+			if (!KeyPool::Instance().Get(_prvKey, _pubKey))
+				Generate(_prvKey, _pubKey);
+		}
+
+		void Curve25519::Generate(uint8_t* prvKey, uint8_t* pubKey)
 		{
 			const unsigned char basepoint[32] = { 9 };
 
 			// generate private key
-			t_random(_prvKey, KeySize);
+			t_random(prvKey, KeySize);
 
-			uint8_t* p = _prvKey;
+			uint8_t* p = prvKey;
 			p[0] &= 248;
 			p[31] &= 127;
 			p[31] |= 64;
 
 			// calculate public key
-			curve25519(_pubKey, p, basepoint);
-		};
+			curve25519(pubKey, p, basepoint);
+		}
 
 		// return own public key
 		const uint8_t* Curve25519::getPublicKey()
@@ -163,6 +449,79 @@ namespace Hap
 			return _secret;
 		}
 
+		void KeyPool::Start()
+		{
+			std::lock_guard<std::mutex> lock(_mtx);
+
+			if (_run)
+				return;
+
+			_run = true;
+			_thread = std::thread(&KeyPool::_refill, this);
+
+#ifdef __linux__
+			// refill only when CPU is idle
+			sched_param prm = { 0 };
+			pthread_setschedparam(_thread.native_handle(), SCHED_IDLE, &prm);
+#endif
+		}
+
+		void KeyPool::Stop()
+		{
+			{
+				std::lock_guard<std::mutex> lock(_mtx);
+
+				if (!_run)
+					return;
+
+				_run = false;
+			}
+
+			_cv.notify_all();
+			_thread.join();
+		}
+
+		bool KeyPool::Get(uint8_t* prvKey, uint8_t* pubKey)
+		{
+			std::lock_guard<std::mutex> lock(_mtx);
+
+			if (_count == 0)
+				return false;
+
+			Key& key = _key[--_count];
+			memcpy(prvKey, key.prv, sizeof(key.prv));
+			memcpy(pubKey, key.pub, sizeof(key.pub));
+			memset(&key, 0, sizeof(key));
+
+			_cv.notify_one();
+			return true;
+		}
+
+		void KeyPool::_refill()
+		{
+			std::unique_lock<std::mutex> lock(_mtx);
+
+			while (_run)
+			{
+				if (_count == Size)
+				{
+					_cv.wait(lock);
+					continue;
+				}
+
+				// generate without the lock, pool may be used meanwhile
+				Key key;
+				lock.unlock();
+				Curve25519::Generate(key.prv, key.pub);
+				lock.lock();
+
+				if (_count < Size)
+					_key[_count++] = key;
+
+				memset(&key, 0, sizeof(key));
+			}
+		}
+
 		Ed25519::Ed25519()
 		{
 
@@ -27,6 +27,8 @@ SOFTWARE.
 
 // Interface to Crypto algorithms
 
+#include "crypt/hmac_sha2.h"
+
 namespace Hap
 {
 	namespace Crypt
@@ -50,6 +52,21 @@ namespace Hap
 			uint16_t aad_size = 0
 		);
 
+		// HAP secure frames - [LE16 length][encrypted data][tag]
+		//	length is AAD of the frame, frame i of a run uses nonce seq + i
+		constexpr static uint16_t FrameHdr = 2;
+
+		// seal size bytes of msg into frames of max block bytes of data
+		//	out must have room for size plus FrameHdr + TagSize per frame,
+		//	returns length of sealed frames
+		size_t aead_seal_frames(uint8_t* out, const uint8_t* key, uint64_t seq,
+			const uint8_t* msg, size_t size, uint16_t block);
+
+		// open count complete frames, data is written back to back into out
+		//	out may not overlap in, returns data length or -1 if any tag does not match
+		int aead_open_frames(uint8_t* out, const uint8_t* key, uint64_t seq,
+			const uint8_t* in, unsigned count);
+
 		void hkdf(
 			const unsigned char *salt, size_t salt_len,
 			const unsigned char *key, size_t key_len,
@@ -57,6 +74,73 @@ namespace Hap
 			unsigned char *okm, unsigned int okm_len
 		);
 
+		// Hkdf - HKDF-SHA512 split into extract and expand steps
+		//	Salt keeps HMAC state keyed by constant salt, so extract only hashes the key material;
+		//	the PRK keyed HMAC state is kept too, so each expand costs two hash blocks.
+		//	Several keys derived from the same salt and key material share one extract
+		class Hkdf
+		{
+		public:
+			constexpr static uint8_t MaxOkm = 64;	// max output of one expand (single HMAC block)
+
+			// precomputed HMAC state of constant salt
+			class Salt
+			{
+			public:
+				Salt(const char* salt);
+				Salt(const uint8_t* salt, size_t salt_len);
+
+			private:
+				friend class Hkdf;
+				hmac_sha512_ctx _hmac;
+			};
+
+			// extract PRK from key material
+			Hkdf(const Salt& salt, const uint8_t* key, size_t key_len);
+			Hkdf(const uint8_t* salt, size_t salt_len, const uint8_t* key, size_t key_len);
+
+			~Hkdf();
+
+			// derive okm_len bytes (up to MaxOkm) for info
+			void expand(const char* info, uint8_t* okm, unsigned okm_len) const;
+			void expand(const uint8_t* info, size_t info_len, uint8_t* okm, unsigned okm_len) const;
+
+		private:
+			hmac_sha512_ctx _prk;
+
+			void _extract(const hmac_sha512_ctx& salt, const uint8_t* key, size_t key_len);
+		};
+
+		// Random - ChaCha20 based random generator
+		//	each thread keeps its own key and keystream cache, so key generation in
+		//	handshake bursts does not serialize on the system entropy source.
+		//	The key is replaced from the keystream on every refill, and mixed with
+		//	system entropy every ReseedSize bytes of output.
+		//	No output is produced until the first seed succeeds, the calling thread waits for it
+		class Random
+		{
+		public:
+			constexpr static uint32_t ReseedSize = 1024 * 1024;
+
+			static void Fill(uint8_t* buf, size_t size);
+
+		private:
+			constexpr static uint16_t KeySize = 32;
+			constexpr static uint16_t CacheSize = 8 * 64;	// keystream blocks per refill
+
+			struct State
+			{
+				uint8_t key[KeySize];
+				uint8_t cache[CacheSize];
+				uint16_t pos = CacheSize;	// next unused byte of cache
+				uint32_t out = ReseedSize;	// bytes since last reseed
+				bool seeded = false;		// key is mixed with system entropy at least once
+			};
+
+			static void _refill(State& st);
+			static bool _entropy(uint8_t* buf, size_t size);
+		};
+
 		class Curve25519
 		{
 		public:
@@ -64,9 +148,12 @@ namespace Hap
 			
 			Curve25519() {}
 
-			// init keys - create new key pair
+			// init keys - take new key pair from the pool, or create it when the pool is empty
 			void Init();
 
+			// create new key pair
+			static void Generate(uint8_t* prvKey, uint8_t* pubKey);
+
 			// return own public key
 			const uint8_t* getPublicKey();
 
@@ -79,6 +166,46 @@ namespace Hap
 			uint8_t _secret[KeySize];
 		};
 
+		// KeyPool - bounded pool of pre-generated Curve25519 key pairs
+		//	the pool is refilled by low-priority background thread between Start and Stop,
+		//	so Pair Verify only needs the shared secret calculation
+		class KeyPool
+		{
+		public:
+			constexpr static uint8_t Size = 8;
+
+			static KeyPool& Instance()
+			{
+				static KeyPool pool;
+				return pool;
+			}
+
+			void Start();
+			void Stop();
+
+			// take key pair from the pool
+			//	returns false if the pool is empty
+			bool Get(uint8_t* prvKey, uint8_t* pubKey);
+
+		private:
+			struct Key
+			{
+				uint8_t prv[Curve25519::KeySize];
+				uint8_t pub[Curve25519::KeySize];
+			};
+
+			Key _key[Size];
+			uint8_t _count = 0;
+			bool _run = false;
+			std::thread _thread;
+			std::mutex _mtx;
+			std::condition_variable _cv;
+
+			KeyPool() {}
+
+			void _refill();
+		};
+
 		class Ed25519
 		{
 		public:
@@ -380,7 +380,10 @@ namespace Hap
 	//	defines set of virtual functions
 	//		getId - returns object id (aid or iid), or null_id
 	//		setId - sequentially sets object id, and all child ids; returns next available id
+	//		setAid - propagates accessory id down to characteristics (used for event reporting)
+	//		enumerate - calls cb for each characteristic of accessory or service (used to build Db index)
 	//		isType - return true if object has property Type and its value matches t
+	//		isVolatile - return true if object value may change without change of configuration (value, ev)
 	//		getDb - return JSON representation of Db object for GET/accessories request
 	//		Write - write single characteristic
 	//				returns true when it completes write to characteristic, 
@@ -395,7 +398,10 @@ namespace Hap
 	public:
 		virtual iid_t getId() { return null_id; }
 		virtual iid_t setId(iid_t iid) { return iid; }
+		virtual void setAid(iid_t aid) {}
+		virtual void enumerate(std::function<void(Obj* ch)> cb) {}
 		virtual bool isType(const char* t) { return false; }
+		virtual bool isVolatile() { return false; }
 		virtual void Open(sid_t sid) {}
 		virtual void Close(sid_t sid) {}
 		virtual int getDb(char* str, int max, sid_t sid) = 0;
@@ -442,6 +448,175 @@ namespace Hap
 		virtual bool Read(rd_prm& p, sid_t sid) { return false; };
 	};
 
+	// Sink - destination of streamed JSON representation of the Db
+	//	data/size - free space in the output buffer
+	//	commit - len bytes were written into the free space
+	//	flush - pass committed data further, whole output buffer becomes free
+	class Sink
+	{
+	public:
+		virtual char* data() = 0;
+		virtual int size() = 0;
+		virtual void commit(int len) = 0;
+		virtual bool flush() = 0;
+
+		// write string, flush output buffer each time it gets full
+		bool write(const char* str, int len)
+		{
+			while (len > 0)
+			{
+				int l = size();
+				if (l == 0)
+				{
+					if (!flush())
+						return false;
+					l = size();
+					if (l == 0)
+						return false;
+				}
+
+				if (l > len)
+					l = len;
+				memcpy(data(), str, l);
+				commit(l);
+				str += l;
+				len -= l;
+			}
+			return true;
+		}
+
+		// write output of getDb-like function, flush and retry when it does not fit
+		//	returns false if the output does not fit into empty buffer
+		bool put(std::function<int(char* str, int max)> get)
+		{
+			for (int i = 0; i < 2; i++)
+			{
+				int max = size();
+				if (max > 0)
+				{
+					int l = get(data(), max);
+					if (l < max)
+					{
+						commit(l);
+						return true;
+					}
+				}
+
+				if (i == 0 && !flush())
+					return false;
+			}
+			return false;
+		}
+	};
+
+	// Skeleton - cached JSON representation of the Db for GET/accessories request
+	//	the skeleton is recorded once by regular getDb with volatile properties omitted,
+	//	their positions are saved in slots and filled on each request
+	class Skeleton
+	{
+	public:
+		struct Slot
+		{
+			uint32_t pos;		// position in the skeleton text
+			Obj* prop;			// volatile property
+			std::mutex* mtx;	// lock of owning characteristic
+		};
+
+	private:
+		char* _buf;
+		uint32_t _size;
+		uint32_t _len = 0;
+		Slot* _slot;
+		uint16_t _slotMax;
+		uint16_t _slotCount = 0;
+		std::mutex* _owner = nullptr;
+		bool _valid = false;
+
+		static Skeleton*& _recording()
+		{
+			static thread_local Skeleton* rec = nullptr;
+			return rec;
+		}
+
+	public:
+		Skeleton(char* buf, uint32_t size, Slot* slot, uint16_t slotMax)
+			: _buf(buf), _size(size), _slot(slot), _slotMax(slotMax)
+		{}
+
+		bool isValid() const { return _valid; }
+		void Invalidate() { _valid = false; }
+
+		// record skeleton, getDb is called with the skeleton buffer
+		//	returns true if the skeleton fits the buffer
+		bool Record(std::function<int(char* str, int max)> getDb)
+		{
+			_slotCount = 0;
+			_valid = _size > 0;
+			if (!_valid)
+				return false;
+
+			_recording() = this;
+			int l = getDb(_buf, _size);
+			_recording() = nullptr;
+
+			if (l < 0 || uint32_t(l) >= _size)
+				_valid = false;
+			else
+				_len = l;
+
+			return _valid;
+		}
+
+		// called by ObjArrayBase::getDb while recording
+		//	returns true if obj is volatile, its position is saved in the slot
+		static bool Mark(char* s, Obj* obj)
+		{
+			Skeleton* rec = _recording();
+			if (rec == nullptr || !obj->isVolatile())
+				return false;
+
+			if (rec->_slotCount < rec->_slotMax)
+				rec->_slot[rec->_slotCount++] = { uint32_t(s - rec->_buf), obj, rec->_owner };
+			else
+				rec->_valid = false;
+
+			return true;
+		}
+
+		// called by characteristic before its properties are recorded
+		static void Owner(std::mutex* mtx)
+		{
+			Skeleton* rec = _recording();
+			if (rec != nullptr)
+				rec->_owner = mtx;
+		}
+
+		// stream the skeleton to sink with volatile properties filled for session sid
+		bool getDb(Sink& sink, sid_t sid) const
+		{
+			uint32_t pos = 0;
+
+			for (uint16_t i = 0; i < _slotCount; i++)
+			{
+				const Slot& slot = _slot[i];
+
+				if (!sink.write(_buf + pos, slot.pos - pos))
+					return false;
+
+				bool rc = sink.put([&slot, sid](char* str, int max) -> int {
+					std::lock_guard<std::mutex> lock(*slot.mtx);
+					return slot.prop->getDb(str, max, sid);
+				});
+				if (!rc)
+					return false;
+
+				pos = slot.pos;
+			}
+
+			return sink.write(_buf + pos, _len - pos);
+		}
+	};
+
 	class ObjArrayBase
 	{
 	protected:
@@ -546,6 +721,13 @@ namespace Hap
 						if (max <= 0) goto Ret;
 					}
 
+					// volatile objects are not recorded in skeleton
+					if (Skeleton::Mark(s, obj))
+					{
+						comma = true;
+						continue;
+					}
+
 					l = obj->getDb(s, max, sid);
 					s += l;
 					max -= l;
@@ -637,6 +819,92 @@ namespace Hap
 		ObjArrayStatic() : ObjArrayBase(_obj, Count) {}
 	};
 
+	// Hap::Events - per-session queues of pending event notifications
+	//	a characteristic pushes itself into the queue of each session that enabled 
+	//	notifications when its value changes, so the cost of collecting events 
+	//	depends on number of changes, not on size of the database
+	//	when a queue overflows, the session falls back to walking the whole database
+	class Events
+	{
+	private:
+		struct Queue
+		{
+			Obj* ch[MaxEvents];
+			uint8_t len = 0;
+			bool overflow = false;
+		} _q[sid_max + 1];
+
+		std::mutex _mtx;
+		std::function<void()> _notify;
+
+	public:
+		static Events& Instance()
+		{
+			static Events events;
+			return events;
+		}
+
+		// set callback called each time an event is queued,
+		//	it is called in context of the thread which changed the value
+		void onEvent(std::function<void()> cb)
+		{
+			std::lock_guard<std::mutex> lock(_mtx);
+			_notify = cb;
+		}
+
+		// queue characteristic ch to session sid
+		void Push(sid_t sid, Obj* ch)
+		{
+			std::function<void()> notify;
+			{
+				std::lock_guard<std::mutex> lock(_mtx);
+
+				Queue& q = _q[sid];
+				if (q.len < sizeofarr(q.ch))
+					q.ch[q.len++] = ch;
+				else
+					q.overflow = true;
+
+				notify = _notify;
+			}
+
+			if (notify)
+				notify();
+		}
+
+		// take all queued characteristics of session sid
+		//	returns number of characteristics copied into ch (up to MaxEvents)
+		//	overflow is set when some events were lost from the queue
+		uint8_t Pop(sid_t sid, Obj** ch, bool& overflow)
+		{
+			std::lock_guard<std::mutex> lock(_mtx);
+
+			Queue& q = _q[sid];
+			uint8_t len = q.len;
+			memcpy(ch, q.ch, len * sizeof(Obj*));
+			overflow = q.overflow;
+			q.len = 0;
+			q.overflow = false;
+
+			return len;
+		}
+
+		bool isPending(sid_t sid)
+		{
+			std::lock_guard<std::mutex> lock(_mtx);
+
+			return _q[sid].len != 0 || _q[sid].overflow;
+		}
+
+		void Clear(sid_t sid)
+		{
+			std::lock_guard<std::mutex> lock(_mtx);
+
+			_q[sid].len = 0;
+			_q[sid].overflow = false;
+		}
+	};
+
 	namespace Property
 	{
 		// Hap::Property::Obj - base class of Properties
@@ -650,6 +918,10 @@ namespace Hap
 			{
 				return _keyId;
 			}
+			virtual bool isVolatile() override
+			{
+				return _keyId == KeyId::value || _keyId == KeyId::ev;
+			}
 			const char* key() const
 			{
 				return KeyStr[int(_keyId)];
@@ -847,11 +1119,18 @@ namespace Hap
 			T get(sid_t sid) const { return _v[sid]; }
 			void set(T v, sid_t sid) { _v[sid] = v; }
 
-			void SetEvent(bool e = true)
+			// set pending event in all sessions which enabled notifications
+			//	ch is the owning characteristic, it is queued to the session once per event
+			void SetEvent(Hap::Obj* ch)
 			{
-				for (unsigned i = 0; i < sizeofarr(_e); i++)
-					if (_v[i])
+				for (sid_t i = 0; i < sizeofarr(_e); i++)
+				{
+					if (_v[i] && !_e[i])
+					{
 						_e[i] = true;
+						Events::Instance().Push(i, ch);
+					}
+				}
 			}
 			
 			bool GetAndClearEvent(sid_t sid)
@@ -919,11 +1198,14 @@ namespace Hap
 			Property::Permissions _perms;
 			Property::Format _format;
 			Property::EventNotifications _ev;	// only valid when _perms contains Events
+			iid_t _aid = null_id;				// accessory id, for event reporting
 
 		protected:
+			std::mutex _mtx;					// protects value and event state, sessions may be processed concurrently
+
 			void AddProperty(Obj* pr) { _prop.set(pr); }
 
-			void SetEvent(bool e = true) { _ev.SetEvent(e); }
+			void SetEvent() { _ev.SetEvent(this); }
 			bool GetAndClearEvent(sid_t sid) { return _ev.GetAndClearEvent(sid); }
 
 		public:
@@ -954,6 +1236,16 @@ namespace Hap
 				return iid;
 			}
 
+			virtual void setAid(iid_t aid) override
+			{
+				_aid = aid;
+			}
+
+			iid_t Aid()
+			{
+				return _aid;
+			}
+
 			virtual bool isType(const char* t) override
 			{
 				return strcmp(t, _type.get()) == 0;
@@ -961,12 +1253,16 @@ namespace Hap
 
 			virtual void Open(sid_t sid) override
 			{
+				std::lock_guard<std::mutex> lock(_mtx);
+
 				// only per-session characteristic is _ev
 				_ev.Open(sid);
 			}
 
 			virtual void Close(sid_t sid) override
 			{
+				std::lock_guard<std::mutex> lock(_mtx);
+
 				// only per-session characteristic is _ev
 				_ev.Close(sid);
 			}
@@ -983,7 +1279,11 @@ namespace Hap
 				max--;
 				if (max <= 0) goto Ret;
 
-				l = _prop.getDb(s, max, sid);
+				{
+					std::lock_guard<std::mutex> lock(_mtx);
+					Skeleton::Owner(&_mtx);
+					l = _prop.getDb(s, max, sid);
+				}
 				s += l;
 				max -= l;
 				if (max <= 0) goto Ret;
@@ -1047,9 +1347,15 @@ namespace Hap
 			}
 
 			// get/set the value
-			V Value() { return _value.get(); }
+			V Value()
+			{
+				std::lock_guard<std::mutex> lock(B::_mtx);
+				return _value.get();
+			}
 			void Value(const V& value) 
 			{ 
+				std::lock_guard<std::mutex> lock(B::_mtx);
+
 				V v = _value.get();
 
 				_value.set(value);
@@ -1069,22 +1375,26 @@ namespace Hap
 
 				if (max <= 0) goto Ret;
 
-				if (B::GetAndClearEvent(sid))
 				{
-					*s++ = '{';
-					max--;
-					if (max <= 0) goto Ret;
+					std::lock_guard<std::mutex> lock(B::_mtx);
 
-					l = snprintf(s, max, "\"aid\":%d,\"iid\":%d,", aid, B::Iid().get());
-					s += l;
-					max -= l;
-					if (max <= 0) goto Ret;
+					if (B::GetAndClearEvent(sid))
+					{
+						*s++ = '{';
+						max--;
+						if (max <= 0) goto Ret;
 
-					l = _value.getDb(s, max, sid);
-					s += l;
-					max -= l;
+						l = snprintf(s, max, "\"aid\":%d,\"iid\":%d,", B::Aid(), B::Iid().get());
+						s += l;
+						max -= l;
+						if (max <= 0) goto Ret;
 
-					*s++ = '}';
+						l = _value.getDb(s, max, sid);
+						s += l;
+						max -= l;
+
+						*s++ = '}';
+					}
 				}
 			Ret:
 				return s - str;
@@ -1107,9 +1417,11 @@ namespace Hap
 					}
 					else
 					{
+						std::lock_guard<std::mutex> lock(B::_mtx);
+
 						B::EventNotifications().set(p.ev_value, sid);
 						if (!p.ev_value)
-							B::SetEvent(false);
+							B::GetAndClearEvent(sid);	// drop pending event, if any
 					}
 				}
 
@@ -1182,7 +1494,10 @@ namespace Hap
 					p.max--;
 					if (p.max <= 0) return true;
 
-					l = _value.getDb(p.s, p.max, sid);
+					{
+						std::lock_guard<std::mutex> lock(B::_mtx);
+						l = _value.getDb(p.s, p.max, sid);
+					}
 					p.s += l;
 					p.max -= l;
 					if (p.max <= 0)	return true;
@@ -1301,7 +1616,10 @@ namespace Hap
 					p.max--;
 					if (p.max <= 0) return true;
 
-					l = B::EventNotifications().getDb(p.s, p.max, sid);
+					{
+						std::lock_guard<std::mutex> lock(B::_mtx);
+						l = B::EventNotifications().getDb(p.s, p.max, sid);
+					}
 					p.s += l;
 					p.max -= l;
 					if (p.max <= 0)	return true;
@@ -1333,9 +1651,17 @@ namespace Hap
 
 			// get/set the value
 			const V* Value() const { return _value.get(); }
-			void Value(const V* v, uint16_t length) { _value.set(v, length); }
+			void Value(const V* v, uint16_t length)
+			{
+				std::lock_guard<std::mutex> lock(this->_mtx);
+				_value.set(v, length);
+			}
 			V Value(int i) const { return _value.get(i); }
-			void Value(int i, V v) { _value.set(i, v); }
+			void Value(int i, V v)
+			{
+				std::lock_guard<std::mutex> lock(this->_mtx);
+				_value.set(i, v);
+			}
 		};
 	}
 
@@ -1424,6 +1750,26 @@ namespace Hap
 			return iid;
 		}
 
+		virtual void setAid(iid_t aid) override
+		{
+			for (int i = 0; i < _char.size(); i++)
+			{
+				auto ch = GetCharacteristic(i);
+				if (ch != nullptr)
+					ch->setAid(aid);
+			}
+		}
+
+		virtual void enumerate(std::function<void(Obj* ch)> cb) override
+		{
+			for (int i = 0; i < _char.size(); i++)
+			{
+				auto ch = GetCharacteristic(i);
+				if (ch != nullptr)
+					cb(ch);
+			}
+		}
+
 		virtual bool isType(const char* t) override
 		{
 			return strcmp(t, _type.get()) == 0;
@@ -1546,6 +1892,7 @@ namespace Hap
 					continue;
 
 				iid = serv->setId(iid);
+				serv->setAid(aid);
 			}
 
 			return iid;
@@ -1557,6 +1904,16 @@ namespace Hap
 			return _aid.get();
 		}
 
+		virtual void enumerate(std::function<void(Obj* ch)> cb) override
+		{
+			for (int i = 0; i < _serv.size(); i++)
+			{
+				Obj* serv = _serv.get(i);
+				if (serv != nullptr)
+					serv->enumerate(cb);
+			}
+		}
+
 		virtual void Open(sid_t sid) override
 		{
 			for (int i = 0; i < _serv.size(); i++)
@@ -1669,23 +2026,117 @@ namespace Hap
 	// Hap::Db - top database object, not inherited from Obj
 	//	- does not allocate storage for accessories, the storage must be passed into
 	//		constructor; use DbStatic for statically allocate the accessory storage
-	//	- all access to Db object must be externally serialized
+	//	- the database structure is built once during initialization and is immutable after that,
+	//		characteristic values and event state are protected by per-characteristic locks, 
+	//		so requests from different sessions may be processed concurrently
+	//	- characteristics are found through (aid,iid) hash index built once after instance IDs
+	//		are assigned; the index storage is passed into constructor, when it is too small
+	//		Read/Write fall back to walking the database
 	class Db
 	{
+	public:
+		struct IndexEntry
+		{
+			iid_t aid;
+			iid_t iid;
+			Obj* ch;			// nullptr - free entry
+		};
+
 	private:
 		ObjArrayBase& _acc;		// array of accessories
 
+		IndexEntry* _idx;		// open-addressing hash index
+		uint16_t _idxSize;		// index size, power of two
+		bool _indexed = false;	// index is valid
+		std::once_flag _indexOnce;
+
+		Skeleton _skel;			// cached GET/accessories response
+		uint32_t _skelConfig = 0;	// config number the skeleton was recorded with
+		uint16_t _skelUsers = 0;	// sessions streaming the skeleton, it is not re-recorded meanwhile
+		std::mutex _skelMtx;		// protects the fields above, not held while streaming
+
+		static uint16_t _hash(iid_t aid, iid_t iid)
+		{
+			uint32_t h = aid * 0x9E3779B1u ^ iid * 0x85EBCA6Bu;
+			return uint16_t(h ^ (h >> 16));
+		}
+
+		// find characteristic by aid and iid, or accessory by aid when index is not valid
+		Obj* _find(iid_t aid, iid_t iid)
+		{
+			Index();
+
+			if (!_indexed)
+				return GetAcc(aid);
+
+			uint16_t mask = _idxSize - 1;
+			for (uint16_t i = _hash(aid, iid) & mask; _idx[i].ch != nullptr; i = (i + 1) & mask)
+			{
+				if (_idx[i].aid == aid && _idx[i].iid == iid)
+					return _idx[i].ch;
+			}
+
+			return nullptr;
+		}
+
 	protected:
 		void AddAcc(Obj* acc) {	_acc.set(acc); }
 		Obj* GetAcc(iid_t id) { return _acc.GetObj(id); }
 
 	public:
-		Db(ObjArrayBase& acc)
-			: _acc(acc)
+		Db(ObjArrayBase& acc, IndexEntry* idx = nullptr, uint16_t idxSize = 0,
+			char* skel = nullptr, uint32_t skelSize = 0, Skeleton::Slot* slot = nullptr, uint16_t slotCount = 0)
+			: _acc(acc), _idx(idx), _idxSize(idxSize), _skel(skel, skelSize, slot, slotCount)
 		{}
 
+		// build (aid,iid) index
+		//	must be called after all instance IDs are assigned, otherwise it is built on first Read/Write
+		void Index()
+		{
+			std::call_once(_indexOnce, [this]() {
+				uint16_t cnt = 0;
+				uint16_t mask = _idxSize - 1;
+				bool ok = _idxSize > 0;
+
+				for (uint16_t i = 0; i < _idxSize; i++)
+					_idx[i].ch = nullptr;
+
+				for (int i = 0; i < _acc.size() && ok; i++)
+				{
+					Obj* acc = _acc.get(i);
+					if (acc == nullptr)
+						continue;
+
+					iid_t aid = acc->getId();
+					acc->enumerate([this, aid, mask, &cnt, &ok](Obj* ch) {
+						// keep the index at most half full
+						if (++cnt > _idxSize / 2)
+						{
+							ok = false;
+							return;
+						}
+
+						uint16_t k = _hash(aid, ch->getId()) & mask;
+						while (_idx[k].ch != nullptr)
+							k = (k + 1) & mask;
+
+						_idx[k].aid = aid;
+						_idx[k].iid = ch->getId();
+						_idx[k].ch = ch;
+					});
+				}
+
+				_indexed = ok;
+
+				if (!ok)
+					Log("Db: index is too small, characteristics are searched in the database\n");
+			});
+		}
+
 		void Open(sid_t sid)
 		{
+			Events::Instance().Clear(sid);
+
 			// propagate Open down to accessories
 			for (int i = 0; i < _acc.size(); i++)
 			{
@@ -1706,11 +2157,81 @@ namespace Hap
 				if (acc != nullptr)
 					acc->Close(sid);
 			}
+
+			Events::Instance().Clear(sid);
+		}
+
+		// drop cached GET/accessories response
+		//	must be called when static properties are changed without change of config number
+		void Invalidate()
+		{
+			std::lock_guard<std::mutex> lock(_skelMtx);
+			_skel.Invalidate();
+		}
+
+		// stream JSON-formatted database into sink
+		//	the cached skeleton is used when available, it is re-recorded when config number changes
+		//	the sink may send to the network, so only the skeleton reference is taken under the lock;
+		//	while other sessions stream an outdated skeleton, the accessories are serialized directly
+		//	returns false if sink fails, or if some accessory does not fit into the sink buffer
+		bool getDb(sid_t sid, Sink& sink)
+		{
+			bool skel;
+			{
+				std::lock_guard<std::mutex> lock(_skelMtx);
+
+				if ((!_skel.isValid() || _skelConfig != config->configNum) && _skelUsers == 0)
+				{
+					_skelConfig = config->configNum;
+					if (_skel.Record([this](char* s, int max) { return _getDb(0, s, max); }))
+						Log("Db: skeleton recorded\n");
+				}
+
+				skel = _skel.isValid() && _skelConfig == config->configNum;
+				if (skel)
+					_skelUsers++;
+			}
+
+			if (skel)
+			{
+				bool rc = _skel.getDb(sink, sid);
+
+				std::lock_guard<std::mutex> lock(_skelMtx);
+				_skelUsers--;
+				return rc;
+			}
+
+			// no skeleton, serialize accessories one by one
+			bool comma = false;
+
+			if (!sink.write("{\"accessories\":[", 16))
+				return false;
+
+			for (int i = 0; i < _acc.size(); i++)
+			{
+				Obj* acc = _acc.get(i);
+				if (acc == nullptr)
+					continue;
+
+				if (comma && !sink.write(",", 1))
+					return false;
+
+				if (!sink.put([acc, sid](char* s, int max) { return acc->getDb(s, max, sid); }))
+				{
+					Log("Db: accessory %d does not fit output buffer\n", acc->getId());
+					return false;
+				}
+
+				comma = true;
+			}
+
+			return sink.write("]}", 2);
 		}
 
+	private:
 		// get JSON-formatted database
 		//	returns num of charactes written to str (up to max)
-		int getDb(sid_t sid, char* str, int max)
+		int _getDb(sid_t sid, char* str, int max)
 		{
 			char* s = str;
 			int l;
@@ -1724,12 +2245,20 @@ namespace Hap
 			l = _acc.getDb(s, max, sid, "accessories");
 			s += l;
 			max -= l;
+			if (max <= 0) goto Ret;
 
 			*s++ = '}';
 		Ret:
 			return s - str;
 		}
 
+	public:
+		// returns true if session has pending events
+		bool isEvent(sid_t sid)
+		{
+			return Events::Instance().isPending(sid);
+		}
+
 		// collect events
 		//	returns HTTP status and JSON-formatted body for HTTP EVENT
 		//	the rsp_size must be initially set to size of the rsp buffer;
@@ -1738,16 +2267,55 @@ namespace Hap
 		{
 			char* s = rsp;
 			int l, max = rsp_size;
+			Obj* ch[MaxEvents];
+			bool overflow;
 
 			rsp_size = 0;
 
+			uint8_t cnt = Events::Instance().Pop(sid, ch, overflow);
+			if (cnt == 0 && !overflow)
+				return Http::HTTP_200;
+
 			l = snprintf(s, max, "{\"characteristics\":[");
 			s += l;
 			max -= l;
 			if (max <= 0)
 				return Http::HTTP_500;	// Internal error
 
-			l = _acc.getEvents(s, max, sid);
+			if (overflow)
+			{
+				// some events were not queued, walk the whole database
+				l = _acc.getEvents(s, max, sid);
+			}
+			else
+			{
+				// only visit queued characteristics
+				char* e = s;
+				int m = max;
+				for (uint8_t i = 0; i < cnt; i++)
+				{
+					if (e > s)
+					{
+						*e++ = ',';
+						m--;
+						if (m <= 0)
+							return Http::HTTP_500;
+					}
+
+					int n = ch[i]->getEvents(e, m, sid, 0, 0);
+					if (n == 0 && e > s)
+					{
+						e--;	// event was already reported, remove comma
+						m++;
+					}
+					e += n;
+					m -= n;
+					if (m <= 0)
+						return Http::HTTP_500;
+				}
+				l = e - s;
+			}
+
 			if (l == 0)
 			{
 				rsp_size = 0;
@@ -1780,7 +2348,7 @@ namespace Hap
 			Hap::Json::Parser<> wr;
 			int rc = wr.parse(req, req_length);
 
-			Log("parse = %d\n", rc);
+			LogDbg("parse = %d\n", rc);
 
 			rsp_size = 0;
 
@@ -1806,7 +2374,7 @@ namespace Hap
 			}
 
 			int cnt = wr.tk(om[0].i)->size;
-			Log("Request contains %d characteristics\n", cnt);
+			LogDbg("Request contains %d characteristics\n", cnt);
 
 			// prepare response
 			char* s = rsp;
@@ -1897,25 +2465,25 @@ namespace Hap
 					p.remote_present = wr.is_bool(om[5].i, p.remote_value);
 				}
 
-				Log("Characteristic %d:  aid %u  iid %u\n", i, p.aid, p.iid);
+				LogDbg("Characteristic %d:  aid %u  iid %u\n", i, p.aid, p.iid);
 				if (p.val_present)
-					Log("      value: '%.*s'\n", wr.length(p.val_ind), wr.start(p.val_ind));
+					LogDbg("      value: '%.*s'\n", wr.length(p.val_ind), wr.start(p.val_ind));
 				if (p.ev_present)
-					Log("         ev: %s\n", p.ev_value ? "true" : "false");
+					LogDbg("         ev: %s\n", p.ev_value ? "true" : "false");
 				if (p.auth_present)
-					Log("   authData: '%.*s'\n", wr.length(p.auth_ind), wr.start(p.auth_ind));
+					LogDbg("   authData: '%.*s'\n", wr.length(p.auth_ind), wr.start(p.auth_ind));
 				if (p.remote_present)
-					Log("         ev: %s\n", p.remote_value ? "true" : "false");
+					LogDbg("         ev: %s\n", p.remote_value ? "true" : "false");
 
-				// find accessory by aid
-				auto acc = GetAcc(p.aid);
-				if (acc == nullptr)
+				// find characteristic by aid and iid
+				auto obj = _find(p.aid, p.iid);
+				if (obj == nullptr)
 				{
 					p.status = Hap::Status::ResourceNotExist;
 				}
 				else
 				{
-					if (!acc->Write(p, sid))
+					if (!obj->Write(p, sid))
 						p.status = Hap::Status::ResourceNotExist;
 				}
 
@@ -2084,7 +2652,7 @@ namespace Hap
 				l--;
 			}
 
-			Log("Read: '%.*s' meta %d  perms %d  type %d  ev %d\n", id_length, id, p.meta, p.perms, p.type, p.ev);
+			LogDbg("Read: '%.*s' meta %d  perms %d  type %d  ev %d\n", id_length, id, p.meta, p.perms, p.type, p.ev);
 
 			if (id_length == 0)
 				return Http::HTTP_400;	// id mus be present
@@ -2135,7 +2703,7 @@ namespace Hap
 					id_length--;
 					read_aid = true;
 
-					Log("Read: aid %d iid %d\n", p.aid, p.iid);
+					LogDbg("Read: aid %d iid %d\n", p.aid, p.iid);
 
 					if (acccnt > 0)
 					{
@@ -2152,15 +2720,15 @@ namespace Hap
 					p.s = s;
 					p.max = max;
 
-					// find accessory by aid
-					auto acc = GetAcc(p.aid);
-					if (acc == nullptr)
+					// find characteristic by aid and iid
+					auto obj = _find(p.aid, p.iid);
+					if (obj == nullptr)
 					{
 						p.status = Hap::Status::ResourceNotExist;
 					}
 					else
 					{
-						if (!acc->Read(p, sid))
+						if (!obj->Read(p, sid))
 							p.status = Hap::Status::ResourceNotExist;
 					}
 
@@ -2213,14 +2781,26 @@ namespace Hap
 		}
 	};
 
-	template<int AccCount>		// max number of Accessories
+	template<
+		int AccCount,					// max number of Accessories
+		int CharCount = AccCount * 32,	// max number of Characteristics in all accessories
+		int SkelSize = CharCount * 128	// size of cached GET/accessories response
+	>
 	class DbStatic : public Db
 	{
 	private:
+		static constexpr uint16_t indexSize(uint16_t n, uint16_t size = 1)
+		{
+			return size >= n * 2 ? size : indexSize(n, size * 2);
+		}
+
 		ObjArrayStatic<AccCount> _acc;
+		IndexEntry _idx[indexSize(CharCount)];
+		char _skel[SkelSize];
+		Skeleton::Slot _slot[CharCount * 2];	// value and ev of each characteristic
 	public:
 		DbStatic() 
-			: Db(_acc) 
+			: Db(_acc, _idx, sizeofarr(_idx), _skel, sizeof(_skel), _slot, sizeofarr(_slot))
 		{}
 	};
 }
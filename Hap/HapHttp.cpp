@@ -39,21 +39,150 @@ namespace Hap
 		uint8_t srp_shared_secret[64];		// SRP shared secret
 		sid_t srp_owner = sid_invalid;		// session owning the srp
 		uint8_t srp_auth_count = 0;			// auth attempts counter
+		std::mutex srp_mtx;					// protects pairing state and pairings updates
+
+		// HKDF salts of HAP key derivations, salt keyed HMAC states are computed once
+		static const Crypt::Hkdf::Salt PairSetupEncryptSalt("Pair-Setup-Encrypt-Salt");
+		static const Crypt::Hkdf::Salt PairSetupAccessorySignSalt("Pair-Setup-Accessory-Sign-Salt");
+		static const Crypt::Hkdf::Salt PairVerifyEncryptSalt("Pair-Verify-Encrypt-Salt");
+		static const Crypt::Hkdf::Salt PairVerifyResumeSalt("Pair-Verify-ResumeSessionID-Salt");
+		static const Crypt::Hkdf::Salt ControlSalt("Control-Salt");
+
+		// get buffer for new session
+		//	returns nullptr if no free buffers
+		Server::Buf* Server::_bufAcquire()
+		{
+			if (_bufCount == 1)		// shared buffer
+				return _buf;
+
+			for (unsigned i = 0; i < _bufCount; i++)
+			{
+				if (_bufUsed[i])
+					continue;
+
+				_bufUsed[i] = true;
+				return &_buf[i];
+			}
+
+			return nullptr;
+		}
+
+		void Server::_bufRelease(Buf* buf)
+		{
+			if (_bufCount == 1 || buf == nullptr)
+				return;
+
+			_bufUsed[buf - _buf] = false;
+		}
+
+		void ResumeCache::Ttl(uint32_t ttl)
+		{
+			std::lock_guard<std::mutex> lock(_mtx);
+
+			_ttl = ttl;
+			if (_ttl == 0)
+			{
+				for (auto& e : _entry)
+				{
+					memset(e.secret, 0, sizeof(e.secret));
+					e.used = false;
+				}
+			}
+		}
+
+		bool ResumeCache::_expired(const Entry& e, Clock::time_point now)
+		{
+			return now - e.time >= std::chrono::seconds(_ttl);
+		}
+
+		void ResumeCache::Put(const uint8_t* id, const uint8_t* secret, const Controller* ios)
+		{
+			std::lock_guard<std::mutex> lock(_mtx);
+
+			if (_ttl == 0)
+				return;
+
+			// use free or expired slot, or replace the oldest entry
+			auto now = Clock::now();
+			Entry* e = &_entry[0];
+			for (auto& i : _entry)
+			{
+				if (!i.used || _expired(i, now))
+				{
+					e = &i;
+					break;
+				}
+				if (i.time < e->time)
+					e = &i;
+			}
+
+			e->used = true;
+			e->time = now;
+			memcpy(e->id, id, IdSize);
+			memcpy(e->secret, secret, SecretSize);
+			e->iosIdLen = ios->idLen;
+			memcpy(e->iosId, ios->id, ios->idLen);
+		}
+
+		bool ResumeCache::Take(const uint8_t* id, uint8_t* secret, Controller::Id& iosId, uint8_t& iosIdLen)
+		{
+			std::lock_guard<std::mutex> lock(_mtx);
+
+			auto now = Clock::now();
+			for (auto& e : _entry)
+			{
+				if (!e.used || memcmp(e.id, id, IdSize) != 0)
+					continue;
+
+				// each session ID is used only once
+				e.used = false;
+				if (_expired(e, now))
+				{
+					memset(e.secret, 0, sizeof(e.secret));
+					break;
+				}
+
+				memcpy(secret, e.secret, SecretSize);
+				memset(e.secret, 0, sizeof(e.secret));
+				iosIdLen = e.iosIdLen;
+				memcpy(iosId, e.iosId, e.iosIdLen);
+				return true;
+			}
+
+			return false;
+		}
 
 		// Open
 		//	returns new session ID, 0..sid_max, or sid_invalid
 		sid_t Server::Open()
 		{
+			std::lock_guard<std::mutex> lock(_mtx);
+
 			for (sid_t sid = 0; sid < sizeofarr(_sess); sid++)
 			{
 				if (_sess[sid].isOpen())
 					continue;
 
-				// open session - use same buffers for all sessions
-				_sess[sid].Open(sid, &_buf);
+				// the last slot only reports 'too many sessions', it needs no buffers
+				Buf* buf = nullptr;
+				if (sid <= sid_max)
+				{
+					buf = _bufAcquire();
+					if (buf == nullptr)
+					{
+						Log("Http: Out of session buffers\n");
+						Metrics::Count(Metrics::SessionReject);
+						return sid_invalid;
+					}
+				}
+
+				// open session
+				_sess[sid].Open(sid, buf);
+				Metrics::Count(sid <= sid_max ? Metrics::SessionOpen : Metrics::SessionReject);
 
 				// open database
-				_db.Open(sid);
+				if (sid <= sid_max)
+					_db.Open(sid);
 
 				return sid;
 			}
@@ -65,17 +194,30 @@ namespace Hap
 		//	returns true if opened session was closed
 		bool Server::Close(sid_t sid)
 		{
-			if (sid > sid_max)
+			if (sid > MaxHttpSessions)
 				return false;
 
-			if (!_sess[sid].isOpen())
+			Session* sess = &_sess[sid];
+			std::lock_guard<std::mutex> lock(sess->mtx);
+
+			if (!sess->isOpen())
 				return false;
 
-			_db.Close(sid);
+			if (sid <= sid_max)
+				_db.Close(sid);
+
+			{
+				std::lock_guard<std::mutex> lock(_mtx);
+
+				_bufRelease(sess->buf());
+				sess->Close();
+			}
 
-			_sess[sid].Close();
+			if (sid <= sid_max)
+				Metrics::Count(Metrics::SessionClose);
 
 			// cancel current pairing if any
+			std::lock_guard<std::mutex> srp_lock(srp_mtx);
 			if (srp != NULL && srp_owner == sid)
 			{
 				SRP_free(srp);
@@ -86,15 +228,103 @@ namespace Hap
 			return true;
 		}
 
+		// Sink which sends streamed response body in HTTP chunks
+		//	one chunk per response buffer, the buffer is passed to flush callback when full
+		class ChunkSink : public Hap::Sink
+		{
+		private:
+			static constexpr int HdrLen = 6;	// chunk size, "XXXX\r\n"
+			static constexpr int EndLen = 2;	// "\r\n" after chunk data
+
+			Response& _rsp;
+			std::function<bool()> _flush;
+			char* _hdr = nullptr;				// chunk size position
+			int _len = 0;						// current chunk length
+			int _total = 0;						// total length of data
+
+			void _close()
+			{
+				// chunk is limited by the response buffer, its size fits 4 hex digits
+				char t[HdrLen + 1];
+				snprintf(t, sizeof(t), "%04X\r\n", (uint16_t)_len);
+				memcpy(_hdr, t, HdrLen);
+				memcpy(_rsp.data(), "\r\n", EndLen);
+				_rsp.append(EndLen);
+				_len = 0;
+			}
+
+		public:
+			ChunkSink(Response& rsp, std::function<bool()> flush) : _rsp(rsp), _flush(flush) {}
+
+			int total() const { return _total; }
+
+			// chunk size is written in front of data when the chunk is started
+			virtual char* data() override
+			{
+				return _rsp.data() + (_len == 0 ? HdrLen : 0);
+			}
+
+			// one byte is kept free, full response buffer is treated as overflow
+			virtual int size() override
+			{
+				int max = _rsp.size() - 1 - EndLen - (_len == 0 ? HdrLen : 0);
+				return max > 0 ? max : 0;
+			}
+
+			virtual void commit(int len) override
+			{
+				if (len <= 0)
+					return;
+
+				if (_len == 0)
+				{
+					_hdr = _rsp.data();
+					_rsp.append(HdrLen);
+				}
+
+				_rsp.append(len);
+				_len += len;
+				_total += len;
+			}
+
+			virtual bool flush() override
+			{
+				if (_len > 0)
+					_close();
+
+				if (_rsp.len() > 0 && !_flush())
+					return false;
+
+				_rsp.restart();
+				return true;
+			}
+
+			// close last chunk and add terminating zero-length chunk
+			bool end()
+			{
+				if (_len > 0)
+					_close();
+
+				if (_rsp.size() <= 5 && !flush())
+					return false;
+
+				memcpy(_rsp.data(), "0\r\n\r\n", 5);
+				_rsp.append(5);
+				return true;
+			}
+		};
+
 		bool Server::Process(sid_t sid, Recv recv, Send send)
 		{
 			if (sid > MaxHttpSessions)	// invalid sid
 				return false;
 
 			Session* sess = &_sess[sid];
+			std::lock_guard<std::mutex> lock(sess->mtx);
+
 			bool secured = sess->secured;
 
-			Log("Http::Process Ses %d  secured %d  %s\n", sid, sess->secured, sess->ios ? (sess->ios->perm == Hap::Controller::Admin ? "admin" : "user") : "?");
+			LogDbg("Http::Process Ses %d  secured %d  %s\n", sid, sess->secured, sess->ios ? (sess->ios->perm == Hap::Controller::Admin ? "admin" : "user") : "?");
 
 			if (sid == MaxHttpSessions)	// too many sessions
 			{
@@ -103,407 +333,490 @@ namespace Hap
 				return false;
 			}
 
-			// prepare for request parsing
-			sess->Init();
+			if (sess->closing)
+			{
+				Log("Http: Session %d output error\n", sid);
+				return false;
+			}
+
+			// send output left from previous requests and events first
+			if (!_flush(sess, send))
+			{
+				Log("Http: Send Error\n");
+				return false;
+			}
+
+			// the controller does not read the responses, its requests wait 
+			//	until the socket drains, the caller calls Process again then
+			if (sess->congested())
+				return true;
+
+			// prepare for request parsing, unless the request is continued from previous call
+			if (!sess->receiving())
+				sess->Init();
 
 			// read and parse the HTTP request
-			uint16_t len = 0;		// total len of valid data received so far
-			uint16_t http_len;		// length of http request
+			//	in secured session the encrypted frames are received into sess->data() and decrypted
+			//	one by one into the request buffer as they complete, so the request may span 
+			//	any number of frames up to the size of the request buffer
+			//	the receive state lives in the session, when no more data is available 
+			//	the function returns and the request is continued on next call
+			//	controllers may pipeline requests, all complete requests are processed in turn,
+			//	the responses are sent before the next read and the bytes after the last
+			//	request are kept for the next call
+			uint16_t& len = sess->recvLen;		// length of received encrypted data not decrypted yet
+			uint16_t& http_len = sess->httpLen;	// length of http request received so far
+			bool next = sess->receiving();	// data left after previous request, parse it before reading more
+			bool done = false;		// at least one request is processed by this call
 			while (true)
 			{
-				uint8_t* req = sess->data() + len;
-				uint16_t req_len = sess->sizeofdata() - len;
-				
-				// read next portion of the request
-				int l = recv(sid, (char*)req, req_len);
-				if (l < 0)	// read error
-				{
-					Log("Http: Read Error\n");
-					return false;
-				}
-				if (l == 0)
+				while (true)
 				{
-					Log("Http: Read EOF\n");
-					return false;
-				}
+					if (!next)
+					{
+						// no complete request is left in the buffer, send responses to the ones 
+						//	processed so far before reading, recv may wait for the next request
+						if (!_flush(sess, send))
+						{
+							Log("Http: Send Error\n");
+							return false;
+						}
 
-				len += l;
+						// all received requests are processed, the next one comes with next call
+						if (done && !sess->receiving())
+							return true;
 
-				if (sess->secured)
-				{
-					// it session is secured, decrypt the block - when the whole block is received
-					//	max length of http data that can be processed is defined by MaxHttpFrame/MaxHttpBlock
+						uint8_t* req;
+						uint16_t req_len;
 
-					if (len < 2)	// wait fot at least two bytes of data length 
-						continue;
-					
-					uint8_t *p = sess->data();
-					uint16_t aad = p[0] + ((uint16_t)(p[1]) << 8);	// data length, also serves as AAD for decryption
+						if (sess->secured)
+						{
+							req = sess->data() + len;
+							req_len = sess->sizeofdata() - len;
+						}
+						else
+						{
+							// read directly into request buffer
+							req = (uint8_t*)sess->req.buf() + http_len;
+							req_len = sess->req.size() - http_len;
+						}
 
-					if (aad > MaxHttpBlock)
-					{
-						Log("Http: encrypted block size is too big: %d\n", aad);
-						return false;
+						if (req_len == 0)
+						{
+							Log("Http: request is too big\n");
+							return false;
+						}
+						
+						// read next portion of the request
+						int l = recv(sid, (char*)req, req_len);
+						if (l == RecvAgain)	// wait for more data
+						{
+							Dbg("Http: request incomplete, received %d\n", http_len + len);
+							return true;
+						}
+						if (l < 0)	// read error
+						{
+							Log("Http: Read Error\n");
+							return false;
+						}
+						if (l == 0)
+						{
+							Log("Http: Read EOF\n");
+							return false;
+						}
+
+						if (sess->secured)
+							len += l;
+						else
+							http_len += l;
 					}
 
-					if (len < 2 + aad + 16)	// wait for complete encrypted block
-						continue;
+					if (sess->secured)
+					{
+						// decrypt all complete blocks
+						//	max length of single block is defined by MaxHttpFrame/MaxHttpBlock
+						uint8_t *p = sess->data();
+						uint16_t prev_len = http_len;
+						uint16_t used = 0;		// length of complete blocks
+						uint16_t dlen = 0;		// length of their data
+						unsigned count = 0;
+						while (len - used >= 2)	// wait fot at least two bytes of data length 
+						{
+							uint16_t aad = p[used] + ((uint16_t)(p[used + 1]) << 8);	// data length, also serves as AAD for decryption
 
-					// make 96-bit nonce from receive sequential number
-					uint8_t nonce[12];
-					memset(nonce, 0, sizeof(nonce));
-					memcpy(nonce + 4, &sess->recvSeq, 8);
+							if (aad > MaxHttpBlock)
+							{
+								Log("Http: encrypted block size is too big: %d\n", aad);
+								_flush(sess, send);
+								return false;
+							}
+
+							if (len - used < 2 + aad + 16)	// wait for complete encrypted block
+								break;
+
+							// decrypted data must fit into request buffer
+							if (http_len + dlen + aad > sess->req.size())
+							{
+								Log("Http: request is too big\n");
+								_flush(sess, send);
+								return false;
+							}
+
+							used += 2 + aad + 16;
+							dlen += aad;
+							count++;
+						}
 
-					// decrypt into request buffer
-					uint8_t* b = (uint8_t*)sess->req.buf();
+						if (count > 0)
+						{
+							// decrypt into request buffer, right after previous block
+							uint8_t* b = (uint8_t*)sess->req.buf() + http_len;
+
+							int rc = Hap::Crypt::aead_open_frames(b, sess->ControllerToAccessoryKey,
+								sess->recvSeq, p, count);
+
+							sess->recvSeq += count;
 
-					Hap::Crypt::aead(Hap::Crypt::Decrypt,
-						b, b + aad,							// output data and tag positions
-						sess->ControllerToAccessoryKey,		// decryption key
-						nonce,
-						p + 2, aad,							// encrypted data
-						p, 2								// aad
-					);
+							if (rc < 0)
+							{
+								Log("Http: decrypt error\n");
+								Metrics::Count(Metrics::AeadError);
+								_flush(sess, send);
+								return false;
+							}
 
-					sess->recvSeq++;
+							Metrics::Count(Metrics::AeadOpenBytes, dlen);
+							http_len += dlen;
+
+							// remove the blocks, keep the beginning of next one
+							len -= used;
+							memmove(p, p + used, len);
+						}
+
+						if (http_len == prev_len && !next)	// no complete block yet
+							continue;
+					}
 
-					// compare passed in and calculated tags
-					if (memcmp(b + aad, p + 2 + aad, 16) != 0)
+					next = false;
+
+					// try parsing HTTP request
+					auto status = sess->req.parse(http_len);
+					if (status == sess->req.Error)	// parser error
 					{
-						Log("Http: decrypt error\n");
+						// TODO: make response Internal server error
+						//	queued after responses to previous pipelined requests
+						_send(sess, send);
 						return false;
 					}
 
-					http_len = aad;
-				}
-				else
-				{
-					// otherwise copy received data into request buffer as is
-					memcpy(sess->req.buf(), sess->data(), len);
+					if (status == sess->req.Success)
+					{
+						// headers parsed, wait for complete body
+						int cl;
+						if (!sess->req.hdr(ContentLength, cl) || sess->req.data().len() >= (size_t)cl)
+							break;
+					}
 
-					http_len = len;
+					// request incomplete - try reading more data
 				}
 
-				// try parsing HTTP request
-				auto status = sess->req.parse(http_len);
-				if (status == sess->req.Error)	// parser error
-				{
-					// TODO: make response Internal server error
-					send(sid, sess->rsp.buf(), sess->rsp.len());
-					return false;
-				}
+				// request is complete, bytes after its body belong to the next request
+				int cl = 0;
+				sess->req.hdr(ContentLength, cl);
+				uint16_t req_size = (uint16_t)sess->req.complete(cl);
 
-				if (status == sess->req.Success)
-					// request parsed, stop reading 
-					break;
-
-				if (sess->secured)
+				// encrypted part of the next request waits in data() which is used while 
+				//	the request is processed, keep it at the end of request buffer meanwhile
+				uint8_t* tail = (uint8_t*)sess->req.buf() + sess->req.size() - len;
+				if (len > 0)
 				{
-					// if session is sequred then whole request must fit into single frame
-					// TODO: support multiple frames
-					Log("Http: request doesn not fit into single frame\n");
-					return false;
+					if (http_len + len > sess->req.size())
+					{
+						Log("Http: request is too big\n");
+						_flush(sess, send);
+						return false;
+					}
+					memcpy(tail, sess->data(), len);
 				}
 
-				// request incomplete - try reading more data
-			}
-
-			auto m = sess->req.method();
-			Log("Method: '%.*s'\n", m.len(), m.ptr());
+				// route is set below when the path is recognized
+				Metrics::Timer timer(Metrics::RouteOther);
 
-			auto p = sess->req.path();
-			Log("Path: '%.*s'\n", p.len(), p.ptr());
+				auto m = sess->req.method();
+				LogDbg("Method: '%.*s'\n", m.len(), m.ptr());
 
-			auto d = sess->req.data();
+				auto p = sess->req.path();
+				LogDbg("Path: '%.*s'\n", p.len(), p.ptr());
 
-			for (size_t i = 0; i < sess->req.hdr_count(); i++)
-			{
-				auto n = sess->req.hdr_name(i);
-				auto v = sess->req.hdr_value(i);
-				Log("%.*s: '%.*s'\n", n.len(), n.ptr(), v.len(), v.ptr());
-			}
-
-			if (m.len() == 4 && strncmp(m.ptr(), "POST", 4) == 0)
-			{
-				// POST
-				//		/identify
-				//		/pair-setup
-				//		/pair-verify
-				//		/pairings
+				auto d = sess->req.data();
 
-				if (p.len() == 9 && strncmp(p.ptr(), "/identify", 9) == 0)
+	#if HAP_LOG_LEVEL >= 2
+				for (size_t i = 0; i < sess->req.hdr_count(); i++)
 				{
-					if (_pairings.Count() == 0)
-					{
-						Log("Http: Exec unpaired identify\n");
-						sess->rsp.start(HTTP_204);
-						sess->rsp.end();
-					}
-					else
-					{
-						Log("Http: Unpaired identify prohibited when paired\n");
-						sess->rsp.start(HTTP_400);
-						sess->rsp.add(ContentType, ContentTypeJson);
-						sess->rsp.end("{\"status\":-70401}");
-					}
+					auto n = sess->req.hdr_name(i);
+					auto v = sess->req.hdr_value(i);
+					LogDbg("%.*s: '%.*s'\n", n.len(), n.ptr(), v.len(), v.ptr());
 				}
-				else if (p.len() == 11 && strncmp(p.ptr(), "/pair-setup", 11) == 0)
+	#endif
+
+				if (m.len() == 4 && strncmp(m.ptr(), "POST", 4) == 0)
 				{
-					int len;
-					if (!sess->req.hdr(ContentType, ContentTypeTlv8))
-					{
-						Log("Http: Unknown or missing ContentType\n");
-						sess->rsp.start(HTTP_400);
-						sess->rsp.end();
-					}
-					else if (!sess->req.hdr(ContentLength, len))
+					// POST
+					//		/identify
+					//		/pair-setup
+					//		/pair-verify
+					//		/pairings
+
+					if (p.len() == 9 && strncmp(p.ptr(), "/identify", 9) == 0)
 					{
-						Log("Http: Unknown or missing ContentLength\n");
-						sess->rsp.start(HTTP_400);
-						sess->rsp.end();
+						timer.Set(Metrics::RouteIdentify);
+						if (_pairings.Count() == 0)
+						{
+							Log("Http: Exec unpaired identify\n");
+							sess->rsp.start(HTTP_204);
+							sess->rsp.end();
+						}
+						else
+						{
+							Log("Http: Unpaired identify prohibited when paired\n");
+							sess->rsp.start(HTTP_400);
+							sess->rsp.add(ContentType, ContentTypeJson);
+							sess->rsp.end("{\"status\":-70401}");
+						}
 					}
-					else
+					else if (p.len() == 11 && strncmp(p.ptr(), "/pair-setup", 11) == 0)
 					{
-						sess->tlvi.parse(d.ptr(), d.len());
-						Log("PairSetup: TLV item count %d\n", sess->tlvi.count());
-
-						Tlv::State state;
-						if (!sess->tlvi.get(Tlv::Type::State, state))
+						timer.Set(Metrics::RoutePairSetup);
+						int len;
+						if (!sess->req.hdr(ContentType, ContentTypeTlv8))
+						{
+							Log("Http: Unknown or missing ContentType\n");
+							sess->rsp.start(HTTP_400);
+							sess->rsp.end();
+						}
+						else if (!sess->req.hdr(ContentLength, len))
 						{
-							Log("PairSetup: State not found\n");
+							Log("Http: Unknown or missing ContentLength\n");
+							sess->rsp.start(HTTP_400);
+							sess->rsp.end();
 						}
 						else
 						{
-							switch (state)
+							sess->tlvi.parse(d.ptr(), d.len());
+							LogDbg("PairSetup: TLV item count %d\n", sess->tlvi.count());
+
+							Tlv::State state;
+							if (!sess->tlvi.get(Tlv::Type::State, state))
 							{
-							case Tlv::State::M1:
-								_pairSetup1(sess);
-								break;
+								Log("PairSetup: State not found\n");
+							}
+							else
+							{
+								std::lock_guard<std::mutex> lock(srp_mtx);
 
-							case Tlv::State::M3:
-								_pairSetup3(sess);
-								break;
+								switch (state)
+								{
+								case Tlv::State::M1:
+									_pairSetup1(sess);
+									break;
 
-							case Tlv::State::M5:
-								_pairSetup5(sess);
-								break;
+								case Tlv::State::M3:
+									_pairSetup3(sess);
+									break;
+
+								case Tlv::State::M5:
+									_pairSetup5(sess);
+									break;
 
-							default:
-								Log("PairSetup: Unknown state %d\n", (int)state);
+								default:
+									Log("PairSetup: Unknown state %d\n", (int)state);
+								}
 							}
 						}
 					}
-				}
-				else if (p.len() == 12 && strncmp(p.ptr(), "/pair-verify", 12) == 0)
-				{
-					int len;
-					if (!sess->req.hdr(ContentType, ContentTypeTlv8))
-					{
-						Log("Http: Unknown or missing ContentType\n");
-						sess->rsp.start(HTTP_400);
-						sess->rsp.end();
-					}
-					else if (!sess->req.hdr(ContentLength, len))
+					else if (p.len() == 12 && strncmp(p.ptr(), "/pair-verify", 12) == 0)
 					{
-						Log("Http: Unknown or missing ContentLength\n");
-						sess->rsp.start(HTTP_400);
-						sess->rsp.end();
-					}
-					else
-					{
-						sess->tlvi.parse(d.ptr(), d.len());
-						Log("PairVerify: TLV item count %d\n", sess->tlvi.count());
-
-						Tlv::State state;
-						if (!sess->tlvi.get(Tlv::Type::State, state))
+						timer.Set(Metrics::RoutePairVerify);
+						int len;
+						if (!sess->req.hdr(ContentType, ContentTypeTlv8))
 						{
-							Log("PairVerify: State not found\n");
+							Log("Http: Unknown or missing ContentType\n");
+							sess->rsp.start(HTTP_400);
+							sess->rsp.end();
+						}
+						else if (!sess->req.hdr(ContentLength, len))
+						{
+							Log("Http: Unknown or missing ContentLength\n");
+							sess->rsp.start(HTTP_400);
+							sess->rsp.end();
 						}
 						else
 						{
-							switch (state)
+							sess->tlvi.parse(d.ptr(), d.len());
+							LogDbg("PairVerify: TLV item count %d\n", sess->tlvi.count());
+
+							Tlv::State state;
+							if (!sess->tlvi.get(Tlv::Type::State, state))
 							{
-							case Tlv::State::M1:
-								_pairVerify1(sess);
-								break;
+								Log("PairVerify: State not found\n");
+							}
+							else
+							{
+								switch (state)
+								{
+								case Tlv::State::M1:
+								{
+									// Pair Resume falls back to Pair Verify when the session is not known
+									Tlv::Method method;
+									if (sess->tlvi.get(Tlv::Type::Method, method) && 
+										method == Tlv::Method::PairResume && _pairResume1(sess))
+										secured = sess->ios != nullptr;
+									else
+										_pairVerify1(sess);
+									break;
+								}
 
-							case Tlv::State::M3:
-								_pairVerify3(sess);
-								secured = sess->ios != nullptr;
-								break;
+								case Tlv::State::M3:
+									_pairVerify3(sess);
+									secured = sess->ios != nullptr;
+									break;
 
-							default:
-								Log("PairVerify: Unknown state %d\n", (int)state);
+								default:
+									Log("PairVerify: Unknown state %d\n", (int)state);
+								}
 							}
 						}
 					}
-				}
-				else if (p.len() == 9 && strncmp(p.ptr(), "/pairings", 9) == 0)
-				{
-					int len;
-					if (!sess->secured)
-					{
-						Log("Http: Authorization required\n");
-						sess->rsp.start(HTTP_470);
-						sess->rsp.end();
-					}
-					else if (!sess->req.hdr(ContentType, ContentTypeTlv8))
+					else if (p.len() == 9 && strncmp(p.ptr(), "/pairings", 9) == 0)
 					{
-						Log("Http: Unknown or missing ContentType\n");
-						sess->rsp.start(HTTP_400);
-						sess->rsp.end();
-					}
-					else if (!sess->req.hdr(ContentLength, len))
-					{
-						Log("Http: Unknown or missing ContentLength\n");
-						sess->rsp.start(HTTP_400);
-						sess->rsp.end();
-					}
-					else
-					{
-						sess->tlvi.parse(d.ptr(), d.len());
-						Log("Pairings: TLV item count %d\n", sess->tlvi.count());
-
-						Tlv::State state;
-						if (!sess->tlvi.get(Tlv::Type::State, state))
+						timer.Set(Metrics::RoutePairings);
+						int len;
+						if (!sess->secured)
 						{
-							Log("Pairings: State not found\n");
+							Log("Http: Authorization required\n");
+							sess->rsp.start(HTTP_470);
+							sess->rsp.end();
+						}
+						else if (!sess->req.hdr(ContentType, ContentTypeTlv8))
+						{
+							Log("Http: Unknown or missing ContentType\n");
+							sess->rsp.start(HTTP_400);
+							sess->rsp.end();
+						}
+						else if (!sess->req.hdr(ContentLength, len))
+						{
+							Log("Http: Unknown or missing ContentLength\n");
 							sess->rsp.start(HTTP_400);
 							sess->rsp.end();
 						}
 						else
 						{
-							if(state != Tlv::State::M1)
+							sess->tlvi.parse(d.ptr(), d.len());
+							LogDbg("Pairings: TLV item count %d\n", sess->tlvi.count());
+
+							Tlv::State state;
+							if (!sess->tlvi.get(Tlv::Type::State, state))
 							{
-								Log("Pairings: Invalid State\n");
+								Log("Pairings: State not found\n");
 								sess->rsp.start(HTTP_400);
 								sess->rsp.end();
 							}
 							else
 							{
-								Tlv::Method method;
-								if (!sess->tlvi.get(Tlv::Type::Method, method))
+								if(state != Tlv::State::M1)
 								{
-									Log("Pairings: Method not found\n");
+									Log("Pairings: Invalid State\n");
 									sess->rsp.start(HTTP_400);
 									sess->rsp.end();
 								}
 								else
 								{
-									switch (method)
-									{
-									case Tlv::Method::AddPairing:
-										_pairingAdd(sess);
-										break;
-
-									case Tlv::Method::RemovePairing:
-										_pairingRemove(sess);
-										break;
-
-									case Tlv::Method::ListPairing:
-										_pairingList(sess);
-										break;
-
-									default:
-										Log("Pairings: Unknown method\n");
+									Tlv::Method method;
+									if (!sess->tlvi.get(Tlv::Type::Method, method))
+									{
+										Log("Pairings: Method not found\n");
 										sess->rsp.start(HTTP_400);
 										sess->rsp.end();
 									}
+									else if (method == Tlv::Method::ListPairing)
+									{
+										// the list may be sent while it is created, so it does not take srp_mtx,
+										//	the records are copied out of the pairings one by one
+										_pairingList(sess, send);
+									}
+									else
+									{
+										std::lock_guard<std::mutex> lock(srp_mtx);
+
+										switch (method)
+										{
+										case Tlv::Method::AddPairing:
+											_pairingAdd(sess);
+											break;
+
+										case Tlv::Method::RemovePairing:
+											_pairingRemove(sess);
+											break;
+
+										default:
+											Log("Pairings: Unknown method\n");
+											sess->rsp.start(HTTP_400);
+											sess->rsp.end();
+										}
+									}
 								}
 							}
 						}
 					}
-				}
-				else
-				{
-					Log("Http: Unknown path %.*s\n", p.len(), p.ptr());
-					sess->rsp.start(HTTP_400);
-					sess->rsp.end();
-				}
-			}
-			else if (m.len() == 3 && strncmp(m.ptr(), "GET", 3) == 0)
-			{
-				// GET
-				//		/accessories
-				//		/characteristics
-				if (!sess->secured)
-				{
-					Log("Http: Authorization required\n");
-					sess->rsp.start(HTTP_470);
-					sess->rsp.end();
-				}
-				else if (p.len() == 12 && strncmp(p.ptr(), "/accessories", 12) == 0)
-				{
-					sess->rsp.start(HTTP_200);
-					sess->rsp.add(ContentType, ContentTypeJson);
-					sess->rsp.add(ContentLength, 0);
-					sess->rsp.end();
-
-					int len = _db.getDb(sess->Sid(), sess->rsp.data(), sess->rsp.size());
-
-					Log("Db: '%.*s'\n", len, sess->rsp.data());
-
-					sess->rsp.setContentLength(len);
-				}
-				else if(strncmp(p.ptr(), "/characteristics?", 17) == 0)
-				{
-
-					int len = sess->sizeofdata();
-					auto status = _db.Read(sess->Sid(), p.ptr() + 17, p.len() - 17, (char*)sess->data(), len);
-
-					Log("Read: Status %d  '%.*s'\n", status, len, sess->data());
-
-					sess->rsp.start(status);
-					if (len > 0)
-					{
-						sess->rsp.add(ContentType, ContentTypeJson);
-						sess->rsp.end((const char*)sess->data(), len);
-					}
 					else
 					{
+						Log("Http: Unknown path %.*s\n", p.len(), p.ptr());
+						sess->rsp.start(HTTP_400);
 						sess->rsp.end();
 					}
 				}
-				else
-				{
-					Log("Http: Unknown path %.*s\n", p.len(), p.ptr());
-					sess->rsp.start(HTTP_400);
-					sess->rsp.end();
-				}
-			}
-			else if (m.len() == 3 && strncmp(m.ptr(), "PUT", 3) == 0)
-			{
-				// PUT
-				//		/characteristics
-				if (p.len() == 16 && strncmp(p.ptr(), "/characteristics", 16) == 0)
+				else if (m.len() == 3 && strncmp(m.ptr(), "GET", 3) == 0)
 				{
-					int len;
+					// GET
+					//		/accessories
+					//		/characteristics
 					if (!sess->secured)
 					{
 						Log("Http: Authorization required\n");
 						sess->rsp.start(HTTP_470);
 						sess->rsp.end();
 					}
-					else if (!sess->req.hdr(ContentType, ContentTypeJson))
-					{
-						Log("Http: Unknown or missing ContentType\n");
-						sess->rsp.start(HTTP_400);
-						sess->rsp.end();
-					}
-					else if (!sess->req.hdr(ContentLength, len))
+					else if (p.len() == 12 && strncmp(p.ptr(), "/accessories", 12) == 0)
 					{
-						Log("Http: Unknown or missing ContentLength\n");
-						sess->rsp.start(HTTP_400);
+						timer.Set(Metrics::RouteAccessories);
+						// database size is not limited by response buffer, 
+						//	it is sent in chunks as the buffer fills up
+						sess->rsp.start(HTTP_200);
+						sess->rsp.add(ContentType, ContentTypeJson);
+						sess->rsp.add(TransferEncoding, "chunked");
 						sess->rsp.end();
+
+						ChunkSink sink(sess->rsp, [this, sess, &send]() -> bool {
+							return _send(sess, send);
+						});
+
+						if (!_db.getDb(sess->Sid(), sink) || !sink.end())
+						{
+							// part of the response could be sent already, close the connection
+							Log("Db: cannot send database\n");
+							return false;
+						}
+
+						LogDbg("Db: %d bytes\n", sink.total());
 					}
-					else
+					else if(strncmp(p.ptr(), "/characteristics?", 17) == 0)
 					{
-						Log("Http: %.*s\n", d.len(), d.ptr());
+						timer.Set(Metrics::RouteCharRead);
 
 						int len = sess->sizeofdata();
-						auto status = _db.Write(sess->Sid(), (const char*)d.ptr(), d.len(), (char*)sess->data(), len);
+						auto status = _db.Read(sess->Sid(), p.ptr() + 17, p.len() - 17, (char*)sess->data(), len);
 
-						Log("Write: Status %d  '%.*s'\n", status, len, sess->data());
+						LogDbg("Read: Status %d  '%.*s'\n", status, len, sess->data());
 
 						sess->rsp.start(status);
 						if (len > 0)
@@ -516,30 +829,150 @@ namespace Hap
 							sess->rsp.end();
 						}
 					}
+					else
+					{
+						Log("Http: Unknown path %.*s\n", p.len(), p.ptr());
+						sess->rsp.start(HTTP_400);
+						sess->rsp.end();
+					}
 				}
-				else
+				else if (m.len() == 3 && strncmp(m.ptr(), "PUT", 3) == 0)
+				{
+					// PUT
+					//		/characteristics
+					if (p.len() == 16 && strncmp(p.ptr(), "/characteristics", 16) == 0)
+					{
+						timer.Set(Metrics::RouteCharWrite);
+						int len;
+						if (!sess->secured)
+						{
+							Log("Http: Authorization required\n");
+							sess->rsp.start(HTTP_470);
+							sess->rsp.end();
+						}
+						else if (!sess->req.hdr(ContentType, ContentTypeJson))
+						{
+							Log("Http: Unknown or missing ContentType\n");
+							sess->rsp.start(HTTP_400);
+							sess->rsp.end();
+						}
+						else if (!sess->req.hdr(ContentLength, len))
+						{
+							Log("Http: Unknown or missing ContentLength\n");
+							sess->rsp.start(HTTP_400);
+							sess->rsp.end();
+						}
+						else
+						{
+							LogDbg("Http: %.*s\n", d.len(), d.ptr());
+
+							int len = sess->sizeofdata();
+							auto status = _db.Write(sess->Sid(), (const char*)d.ptr(), d.len(), (char*)sess->data(), len);
+
+							LogDbg("Write: Status %d  '%.*s'\n", status, len, sess->data());
+
+							sess->rsp.start(status);
+							if (len > 0)
+							{
+								sess->rsp.add(ContentType, ContentTypeJson);
+								sess->rsp.end((const char*)sess->data(), len);
+							}
+							else
+							{
+								sess->rsp.end();
+							}
+						}
+					}
+					else
+					{
+						Log("Http: Unknown path %.*s\n", p.len(), p.ptr());
+						sess->rsp.start(HTTP_400);
+						sess->rsp.end();
+					}
+				}
+
+				// with own output queue the responses to pipelined requests are sealed back to back
+				//	and sent together before the next read
+				if (!_send(sess, send, !sess->queue()))
+					return false;
+
+				if (len > 0)
+					memcpy(sess->data(), tail, len);
+
+				// bytes received after the request start the next one
+				uint16_t rest = http_len - req_size;
+				sess->Init();
+				memmove(sess->req.buf(), sess->req.buf() + req_size, rest);
+				http_len = rest;
+
+				// the session becomes secured after the response, following bytes are
+				//	encrypted frames received as plain data, move them to be decrypted
+				if (secured && !sess->secured && http_len > 0)
 				{
-					Log("Http: Unknown path %.*s\n", p.len(), p.ptr());
-					sess->rsp.start(HTTP_400);
-					sess->rsp.end();
+					if (http_len > sess->sizeofdata())
+					{
+						Log("Http: request is too big\n");
+						_flush(sess, send);
+						return false;
+					}
+
+					memcpy(sess->data(), sess->req.buf(), http_len);
+					len = http_len;
+					http_len = 0;
 				}
-			}
 
-			if (!_send(sess, send))
-				return false;
+				sess->secured = secured;
+				LogDbg("Http::Process request done Ses %d  secured %d\n", sid, sess->secured);
 
-			sess->secured = secured;
-			Log("Http::Process exit Ses %d  secured %d\n", sid, sess->secured);
+				next = true;
+				done = true;
 
-			return true;
+				// stop before the next pipelined request when the responses pile up,
+				//	it is processed when the socket drains
+				if (sess->congested())
+				{
+					if (!_flush(sess, send))
+					{
+						Log("Http: Send Error\n");
+						return false;
+					}
+
+					if (sess->congested())
+						return true;
+				}
+			}
 		}
 
 		void Server::Poll(sid_t sid, Send send)
 		{
 			Session* sess = &_sess[sid];
-			if (!sess->secured)
+
+			// skip the session if its request is being processed
+			std::unique_lock<std::mutex> lock(sess->mtx, std::try_to_lock);
+			if (!lock.owns_lock())
+				return;
+
+			if (!sess->secured || sess->closing)
 				return;
 
+			// request buffers hold partially received request
+			if (sess->receiving())
+				return;
+
+			Metrics::Count(Metrics::PollCount);
+
+			// send queued output, while the queue is more than half full events stay 
+			//	pending in the database and are coalesced into next notification
+			//	send errors are detected by next Process
+			if (!_flush(sess, send) || sess->congested())
+				return;
+
+			if (!_db.isEvent(sid))
+				return;
+
+			// previous request could leave the response in any state
+			sess->Init();
+
 			int len = sess->sizeofdata();
 			auto status = _db.getEvents(sid, (char*)sess->data(), len);
 
@@ -549,71 +982,166 @@ namespace Hap
 			if (len == 0)
 				return;
 
-			Log("Events: sid %d  '%.*s'\n", sid, len, sess->data());
+			LogDbg("Events: sid %d  '%.*s'\n", sid, len, sess->data());
 
 			sess->rsp.event(status);
 			sess->rsp.add(ContentType, ContentTypeJson);
 			sess->rsp.end((const char*)sess->data(), len);
 
-			_send(sess, send);
+			Metrics::Count(Metrics::PollEvents);
+
+			// part of the event may be queued or sent already, the stream cannot continue
+			if (!_send(sess, send))
+			{
+				sess->outHead = sess->outTail = 0;
+				sess->closing = true;
+			}
+		}
+
+		void Server::onEvent(std::function<void()> cb)
+		{
+			Events::Instance().onEvent(cb);
 		}
 
-		bool Server::_send(Session* sess, Send& send)
+		// queue response for sending
+		//	sealed frames (plain response in unsecured session) are appended to the output queue
+		//	and sent as far as the socket accepts them, the rest goes out on following calls
+		//	flush false leaves the queued data for later _flush, unless the queue is full
+		//	never waits for the socket, returns false on send error or when the output queue overflows
+		bool Server::_send(Session* sess, Send& send, bool flush)
 		{
-			if (sess->secured)
+			const uint8_t *p = (uint8_t*)sess->rsp.buf();
+			uint16_t len = sess->rsp.len();				// data length
+			uint8_t* out = sess->out();					// output queue, must be >= MaxHttpFrame
+			uint16_t size = sess->sizeofout();
+
+			while (len > 0)
 			{
-				// session secured - encrypt data
-				const uint8_t *p = (uint8_t*)sess->rsp.buf();
-				uint16_t len = sess->rsp.len();				// data length
-				
-				while (len > 0)
+				// smallest portion worth queuing - one block of secured data
+				uint16_t need = 1;
+				if (sess->secured)
+					need = 2 + (len > MaxHttpBlock ? MaxHttpBlock : len) + 16;
+
+				// move queued data to the beginning of the buffer when the tail is short
+				if (size - sess->outTail < need && sess->outHead > 0)
 				{
-					uint16_t aad = len;		// block length, and AAD for encryption
+					memmove(out, out + sess->outHead, sess->queued());
+					sess->outTail -= sess->outHead;
+					sess->outHead = 0;
+				}
+
+				// queue is full, try sending some of it
+				if (size - sess->outTail < need)
+				{
+					uint16_t queued = sess->queued();
+
+					if (!_flush(sess, send))
+						return false;
+
+					if (sess->queued() == queued)
+					{
+						// response is larger than the queue and the socket buffer
+						Log("Http: output queue overflow, sid %d\n", sess->Sid());
+						Metrics::Count(Metrics::QueueOverflow);
+						return false;
+					}
 
-					if (aad > MaxHttpBlock)
-						aad = MaxHttpBlock;
+					continue;
+				}
 
-					// make 96-bit nonce from send sequential number
-					uint8_t nonce[12];
-					memset(nonce, 0, sizeof(nonce));
-					memcpy(nonce + 4, &sess->sendSeq, 8);
+				uint16_t room = size - sess->outTail;
+				uint16_t l = 0;
 
-					// encrypt into sess->data buffer which must be >= MaxHttpFrame
-					uint8_t* b = sess->data();
+				if (sess->secured)
+				{
+					// take as many whole blocks as fit into the queue
+					while (l < len)
+					{
+						uint16_t aad = len - l;		// block length, and AAD for encryption
 
-					// copy data length into output buffer
-					b[0] = aad & 0xFF;
-					b[1] = (aad >> 8) & 0xFF;
+						if (aad > MaxHttpBlock)
+							aad = MaxHttpBlock;
 
-					Hap::Crypt::aead(Hap::Crypt::Encrypt,
-						b + 2, b + 2 + aad,					// output data and tag positions
-						sess->AccessoryToControllerKey,		// encryption key
-						nonce,
-						p, aad,								// data to encrypt
-						b, 2								// aad
-					);
+						if (2 + aad + 16 > room)
+							break;
 
-					sess->sendSeq++;
+						room -= 2 + aad + 16;
+						l += aad;
+					}
 
-					// send encrypted block
-					send(sess->Sid(), (char*)b, 2 + aad + 16);
+					// seal the blocks back to back, with sequential nonces
+					sess->outTail += (uint16_t)Hap::Crypt::aead_seal_frames(out + sess->outTail, 
+						sess->AccessoryToControllerKey, sess->sendSeq, p, l, MaxHttpBlock);
 
-					len -= aad;
-					p += aad;
+					sess->sendSeq += (l + MaxHttpBlock - 1) / MaxHttpBlock;
+					Metrics::Count(Metrics::AeadSealBytes, l);
+				}
+				else
+				{
+					// response as is
+					l = len < room ? len : room;
+					memcpy(out + sess->outTail, p, l);
+					sess->outTail += l;
 				}
+
+				len -= l;
+				p += l;
 			}
-			else
+
+			if (!flush)
+				return true;
+
+			return _flush(sess, send);
+		}
+
+		// send queued output as far as the socket accepts it
+		//	returns false on send error
+		bool Server::_flush(Session* sess, Send& send)
+		{
+			uint8_t* out = sess->out();
+
+			while (sess->queued() > 0)
 			{
-				//send response as is
-				send(sess->Sid(), sess->rsp.buf(), sess->rsp.len());
+				int l = send(sess->Sid(), (char*)out + sess->outHead, sess->queued());
+				if (l < 0)
+					return false;
+
+				if (l == 0)
+				{
+					// the queue cannot be kept without own output buffer, 
+					//	or when the buffers are shared by all sessions
+					if (!sess->queue() || _bufCount == 1)
+						return false;
+
+					// the rest is sent when the socket becomes writable
+					break;
+				}
+
+				sess->outHead += l;
 			}
 
+			if (sess->queued() == 0)
+				sess->outHead = sess->outTail = 0;
+
 			return true;
 		}
 
+		bool Server::Pending(sid_t sid)
+		{
+			if (sid > sid_max)
+				return false;
+
+			Session* sess = &_sess[sid];
+			std::lock_guard<std::mutex> lock(sess->mtx);
+
+			return sess->queued() != 0 || sess->closing;
+		}
+
 
 		void Server::_pairSetup1(Session* sess)
 		{
+			Metrics::Timer timer(Metrics::PairSetupM1);
+
 			int rc;
 			cstr* pub = NULL;
 
@@ -684,14 +1212,19 @@ namespace Hap
 				goto RetErr;
 			}
 
-			Hex("Username", srp->username->data, srp->username->length);
+			HexDbg("Username", srp->username->data, srp->username->length);
+
+			// salt and verifier are computed once for the setup code
+			if (!_srp.Valid(Hap::config->setupCode) && !_srp.Init(Hap::config->setupCode))
+			{
+				Log("PairSetupM1: SRP verifier error\n");
+				goto RetErr;
+			}
 
-			uint8_t salt[16];
-			t_random(salt, 16);
 			rc = SRP_set_params(srp,
 				srp_modulus, sizeof_srp_modulus,
 				srp_generator, sizeof_srp_generator,
-				salt, sizeof(salt)
+				_srp.Salt(), _srp.SaltSize
 			);
 			if (rc != SRP_SUCCESS)
 			{
@@ -699,19 +1232,17 @@ namespace Hap
 				goto RetErr;
 			}
 
-			Hex("Modulus", srp_modulus, sizeof_srp_modulus);
-			Hex("Generator", srp_generator, sizeof_srp_generator);
-			Hex("Salt", salt, sizeof(salt));
+			HexDbg("Modulus", srp_modulus, sizeof_srp_modulus);
+			HexDbg("Generator", srp_generator, sizeof_srp_generator);
+			HexDbg("Salt", _srp.Salt(), _srp.SaltSize);
 
-			rc = SRP_set_auth_password(srp, Hap::config->setupCode);
+			rc = SRP_set_authenticator(srp, _srp.Data(), _srp.Size());
 			if (rc != SRP_SUCCESS)
 			{
-				Log("PairSetupM1: SRP_set_auth_password error %d\n", rc);
+				Log("PairSetupM1: SRP_set_authenticator error %d\n", rc);
 				goto RetErr;
 			}
 
-			Hex("Username", Hap::config->setupCode, strlen(Hap::config->setupCode));
-
 			rc = SRP_gen_pub(srp, &pub);
 			if (rc != SRP_SUCCESS)
 			{
@@ -719,10 +1250,10 @@ namespace Hap
 				goto RetErr;
 			}
 
-			Hex("ServerKey", pub->data, pub->length);
+			HexDbg("ServerKey", pub->data, pub->length);
 
 			sess->tlvo.add(Hap::Tlv::Type::PublicKey, pub->data, (uint16_t)pub->length);
-			sess->tlvo.add(Hap::Tlv::Type::Salt, salt, sizeof(salt));
+			sess->tlvo.add(Hap::Tlv::Type::Salt, _srp.Salt(), _srp.SaltSize);
 
 			goto Ret;
 
@@ -743,6 +1274,8 @@ namespace Hap
 	
 		void Server::_pairSetup3(Session* sess)
 		{
+			Metrics::Timer timer(Metrics::PairSetupM3);
+
 			int rc;
 			uint16_t size;
 			uint8_t* iosKey = sess->data();
@@ -779,7 +1312,7 @@ namespace Hap
 				goto RetErr;
 			}
 
-			Hex("iosKey", iosKey, iosKey_size);
+			HexDbg("iosKey", iosKey, iosKey_size);
 
 			size = iosProof_size;
 			if (!sess->tlvi.get(Tlv::Type::Proof, iosProof, iosProof_size))
@@ -788,7 +1321,7 @@ namespace Hap
 				goto RetErr;
 			}
 
-			Hex("iosProof", iosProof, iosProof_size);
+			HexDbg("iosProof", iosProof, iosProof_size);
 
 			rc = SRP_compute_key(srp, &key, iosKey, iosKey_size);
 			if (rc != SRP_SUCCESS)
@@ -799,13 +1332,10 @@ namespace Hap
 
 			memcpy(srp_shared_secret, key->data, key->length);
 
-			Hap::Crypt::hkdf(
-				(const uint8_t*)"Pair-Setup-Encrypt-Salt", sizeof("Pair-Setup-Encrypt-Salt") - 1,
-				srp_shared_secret, sizeof(srp_shared_secret),
-				(const uint8_t*)"Pair-Setup-Encrypt-Info", sizeof("Pair-Setup-Encrypt-Info") - 1,
-				sess->key, sizeof(sess->key));
+			Hap::Crypt::Hkdf(PairSetupEncryptSalt, srp_shared_secret, sizeof(srp_shared_secret))
+				.expand("Pair-Setup-Encrypt-Info", sess->key, sizeof(sess->key));
 
-			Hex("SessKey", sess->key, sizeof(sess->key));
+			HexDbg("SessKey", sess->key, sizeof(sess->key));
 
 			rc = SRP_verify(srp, iosProof, size);
 			if (rc != SRP_SUCCESS)
@@ -822,7 +1352,7 @@ namespace Hap
 				goto RetErr;
 			}
 
-			Hex("Response", rsp->data, rsp->length);
+			HexDbg("Response", rsp->data, rsp->length);
 
 			sess->tlvo.add(Hap::Tlv::Type::Proof, rsp->data, (uint16_t)rsp->length);
 
@@ -849,6 +1379,8 @@ namespace Hap
 
 		void Server::_pairSetup5(Session* sess)
 		{
+			Metrics::Timer timer(Metrics::PairSetupM5);
+
 			uint8_t* iosEncrypted;	// encrypted tata from iOS with tag attached
 			uint8_t* iosTag;		// pointer to iOS tag
 			uint8_t* iosTlv;		// decrypted TLV
@@ -899,9 +1431,9 @@ namespace Hap
 					sess->key, (const uint8_t *)"\x00\x00\x00\x00PS-Msg05", 
 					iosEncrypted, iosTlv_size);
 
-				Hex("iosTlv", iosTlv, iosTlv_size);
-				Hex("iosTag", iosTag, 16);
-				Hex("srvTlv", srvTag, 16);
+				HexDbg("iosTlv", iosTlv, iosTlv_size);
+				HexDbg("iosTag", iosTag, 16);
+				HexDbg("srvTlv", srvTag, 16);
 
 				// compare calculated tag with passed in one
 				if (memcmp(iosTag, srvTag, 16) != 0)
@@ -913,7 +1445,7 @@ namespace Hap
 
 				// parse decrypted TLV - 3 items expected
 				Hap::Tlv::Parse<3> tlv(iosTlv, iosTlv_size);
-				Log("PairSetupM5: TLV item count %d\n", tlv.count());
+				LogDbg("PairSetupM5: TLV item count %d\n", tlv.count());
 
 				// extract TLV items
 				if (!tlv.get(Hap::Tlv::Type::Identifier, id))
@@ -921,21 +1453,21 @@ namespace Hap
 					Log("PairSetupM5: Identifier not found\n");
 					goto RetErr;
 				}
-				Hex("iosPairingId:", id.val(), id.len());
+				HexDbg("iosPairingId:", id.val(), id.len());
 
 				if (!tlv.get(Hap::Tlv::Type::PublicKey, ltpk))
 				{
 					Log("PairSetupM5: PublicKey not found\n");
 					goto RetErr;
 				}
-				Hex("iosLTPK:", ltpk.val(), ltpk.len());
+				HexDbg("iosLTPK:", ltpk.val(), ltpk.len());
 
 				if (!tlv.get(Hap::Tlv::Type::Signature, sign))
 				{
 					Log("PairSetupM5: Signature not found\n");
 					goto RetErr;
 				}
-				Hex("iosSignature:", sign.val(), sign.len());
+				HexDbg("iosSignature:", sign.val(), sign.len());
 
 				// TODO: build iOSDeviceInfo and verify iOS device signature
 
@@ -953,11 +1485,8 @@ namespace Hap
 				int l = sess->sizeofdata();
 
 				// add AccessoryX
-				Hap::Crypt::hkdf(
-					(const uint8_t*)"Pair-Setup-Accessory-Sign-Salt", sizeof("Pair-Setup-Accessory-Sign-Salt") - 1,
-					srp_shared_secret, sizeof(srp_shared_secret),
-					(const uint8_t*)"Pair-Setup-Accessory-Sign-Info", sizeof("Pair-Setup-Accessory-Sign-Info") - 1,
-					p, 32);
+				Hap::Crypt::Hkdf(PairSetupAccessorySignSalt, srp_shared_secret, sizeof(srp_shared_secret))
+					.expand("Pair-Setup-Accessory-Sign-Info", p, 32);
 				p += 32;
 				l -= 32;
 				
@@ -1024,6 +1553,8 @@ namespace Hap
 
 		void Server::_pairVerify1(Session* sess)
 		{
+			Metrics::Timer timer(Metrics::PairVerifyM1);
+
 			Hap::Tlv::Item iosKey;
 			const uint8_t* sharedSecret;
 			uint8_t* p;
@@ -1055,11 +1586,8 @@ namespace Hap
 			sharedSecret = sess->curve.getSharedSecret(iosKey.val());
 
 			// create session key from shared secret
-			Hap::Crypt::hkdf(
-				(const uint8_t*)"Pair-Verify-Encrypt-Salt", sizeof("Pair-Verify-Encrypt-Salt") - 1,
-				sharedSecret, sess->curve.KeySize,
-				(const uint8_t*)"Pair-Verify-Encrypt-Info", sizeof("Pair-Verify-Encrypt-Info") - 1,
-				sess->key, sizeof(sess->key));
+			Hap::Crypt::Hkdf(PairVerifyEncryptSalt, sharedSecret, sess->curve.KeySize)
+				.expand("Pair-Verify-Encrypt-Info", sess->key, sizeof(sess->key));
 
 			// construct AccessoryInfo
 			p = sess->data();
@@ -1124,6 +1652,8 @@ namespace Hap
 
 		void Server::_pairVerify3(Session* sess)
 		{
+			Metrics::Timer timer(Metrics::PairVerifyM3);
+
 			uint8_t* iosEncrypted;	// encrypted tata from iOS with tag attached
 			uint8_t* iosTag;		// pointer to iOS tag
 			uint8_t* iosTlv;		// decrypted TLV
@@ -1166,9 +1696,9 @@ namespace Hap
 					sess->key, (const uint8_t *)"\x00\x00\x00\x00PV-Msg03",
 					iosEncrypted, iosTlv_size);
 
-				Hex("iosTlv", iosTlv, iosTlv_size);
-				Hex("iosTag", iosTag, 16);
-				Hex("srvTlv", srvTag, 16);
+				HexDbg("iosTlv", iosTlv, iosTlv_size);
+				HexDbg("iosTag", iosTag, 16);
+				HexDbg("srvTlv", srvTag, 16);
 
 				// compare calculated tag with passed in one
 				if (memcmp(iosTag, srvTag, 16) != 0)
@@ -1180,7 +1710,7 @@ namespace Hap
 
 				// parse decrypted TLV - 2 items expected
 				Hap::Tlv::Parse<2> tlv(iosTlv, iosTlv_size);
-				Log("PairVerifyM3: TLV item count %d\n", tlv.count());
+				LogDbg("PairVerifyM3: TLV item count %d\n", tlv.count());
 
 				// extract TLV items
 				if (!tlv.get(Hap::Tlv::Type::Identifier, id))
@@ -1188,18 +1718,18 @@ namespace Hap
 					Log("PairVerifyM3: Identifier not found\n");
 					goto RetErr;
 				}
-				Hex("iosPairingId:", id.val(), id.len());
+				HexDbg("iosPairingId:", id.val(), id.len());
 
 				if (!tlv.get(Hap::Tlv::Type::Signature, sign))
 				{
 					Log("PairVerifyM3: Signature not found\n");
 					goto RetErr;
 				}
-				Hex("iosSignature:", sign.val(), sign.len());
+				HexDbg("iosSignature:", sign.val(), sign.len());
 
 				// lookup iOS id in pairing database
-				auto ios = _pairings.Get(id);
-				if (ios == nullptr)
+				Controller ios;
+				if (!_pairings.Get(id, ios))
 				{
 					Log("PairVerifyM3: iOS device ID not found\n");
 					sess->tlvo.add(Hap::Tlv::Type::Error, Hap::Tlv::Error::Authentication);
@@ -1209,20 +1739,17 @@ namespace Hap
 				// TODO: construct iOSDeviceInfo and verify signature
 
 				// create session encryption keys
-				Hap::Crypt::hkdf(
-					(const uint8_t*)"Control-Salt", sizeof("Control-Salt") - 1,
-					sess->curve.getSharedSecret(), sess->curve.KeySize,
-					(const uint8_t*)"Control-Read-Encryption-Key", sizeof("Control-Read-Encryption-Key") - 1,
-					sess->AccessoryToControllerKey, sizeof(sess->AccessoryToControllerKey));
-
-				Hap::Crypt::hkdf(
-					(const uint8_t*)"Control-Salt", sizeof("Control-Salt") - 1,
-					sess->curve.getSharedSecret(), sess->curve.KeySize,
-					(const uint8_t*)"Control-Write-Encryption-Key", sizeof("Control-Write-Encryption-Key") - 1,
-					sess->ControllerToAccessoryKey, sizeof(sess->ControllerToAccessoryKey));
+				_sessionKeys(sess, sess->curve.getSharedSecret());
+
+				// keep shared secret for Pair Resume
+				uint8_t sessionId[ResumeCache::IdSize];
+				Hap::Crypt::Hkdf(PairVerifyResumeSalt, sess->curve.getSharedSecret(), sess->curve.KeySize)
+					.expand("Pair-Verify-ResumeSessionID-Info", sessionId, sizeof(sessionId));
+				_resume.Put(sessionId, sess->curve.getSharedSecret(), &ios);
 
 				// mark session as secured after response is sent
-				sess->ios = ios;
+				sess->iosRec = ios;
+				sess->ios = &sess->iosRec;
 
 				goto Ret;
 			}
@@ -1235,12 +1762,133 @@ namespace Hap
 			sess->rsp.setContentLength(sess->tlvo.length());
 		}
 
+		// Pair Resume M1
+		//	returns false when the session cannot be resumed and full Pair Verify must be done
+		bool Server::_pairResume1(Session* sess)
+		{
+			Metrics::Timer timer(Metrics::PairResumeM1);
+
+			Hap::Tlv::Item iosKey;
+			Hap::Tlv::Item sessionId;
+			Hap::Tlv::Item iosTag;
+			Controller::Id iosId;
+			uint8_t iosIdLen;
+			uint8_t secret[ResumeCache::SecretSize];
+			uint8_t salt[Hap::Crypt::Curve25519::KeySize + ResumeCache::IdSize];
+			uint8_t tag[16];
+			Controller ios;
+
+			Log("PairResumeM1\n");
+
+			if (!sess->tlvi.get(Tlv::Type::PublicKey, iosKey) || iosKey.len() != Hap::Crypt::Curve25519::KeySize)
+			{
+				Log("PairResumeM1: PublicKey not found\n");
+				return false;
+			}
+
+			if (!sess->tlvi.get(Tlv::Type::SessionID, sessionId) || sessionId.len() != ResumeCache::IdSize)
+			{
+				Log("PairResumeM1: SessionID not found\n");
+				return false;
+			}
+
+			if (!sess->tlvi.get(Tlv::Type::EncryptedData, iosTag) || iosTag.len() != sizeof(tag))
+			{
+				Log("PairResumeM1: EncryptedData not found\n");
+				return false;
+			}
+
+			if (!_resume.Take(sessionId.val(), secret, iosId, iosIdLen))
+			{
+				Log("PairResumeM1: session not found\n");
+				return false;
+			}
+
+			// controller might be removed since the session was cached
+			if (!_pairings.Get(Hap::Tlv::Item(iosId, iosIdLen), ios))
+			{
+				Log("PairResumeM1: iOS device ID not found\n");
+				memset(secret, 0, sizeof(secret));
+				return false;
+			}
+
+			// verify the request, its encrypted data is empty and holds the tag only
+			memcpy(salt, iosKey.val(), Hap::Crypt::Curve25519::KeySize);
+			memcpy(salt + Hap::Crypt::Curve25519::KeySize, sessionId.val(), ResumeCache::IdSize);
+			Hap::Crypt::Hkdf(salt, sizeof(salt), secret, sizeof(secret))
+				.expand("Pair-Resume-Request-Info", sess->key, sizeof(sess->key));
+
+			Hap::Crypt::aead(Hap::Crypt::Decrypt, sess->data(), tag,
+				sess->key, (const uint8_t *)"\x00\x00\x00\x00PR-Msg01", sess->data(), 0);
+
+			if (memcmp(iosTag.val(), tag, sizeof(tag)) != 0)
+			{
+				Log("PairResumeM1: authTag does not match\n");
+				memset(secret, 0, sizeof(secret));
+				return false;
+			}
+
+			// prepare response without data
+			sess->rsp.start(HTTP_200);
+			sess->rsp.add(ContentType, ContentTypeTlv8);
+			sess->rsp.add(ContentLength, 0);
+			sess->rsp.end();
+
+			// create response TLV in the response buffer right after HTTP headers 
+			sess->tlvo.create((uint8_t*)sess->rsp.data(), sess->rsp.size());
+			sess->tlvo.add(Hap::Tlv::Type::State, Hap::Tlv::State::M2);
+			sess->tlvo.add(Hap::Tlv::Type::Method, Hap::Tlv::Method::PairResume);
+
+			// new session ID for the next resume
+			Hap::Crypt::Random::Fill(salt + Hap::Crypt::Curve25519::KeySize, ResumeCache::IdSize);
+
+			// response key and new shared secret come from the same salt and secret
+			Hap::Crypt::Hkdf hkdf(salt, sizeof(salt), secret, sizeof(secret));
+
+			// response tag
+			hkdf.expand("Pair-Resume-Response-Info", sess->key, sizeof(sess->key));
+
+			Hap::Crypt::aead(Hap::Crypt::Encrypt, sess->data(), tag,
+				sess->key, (const uint8_t *)"\x00\x00\x00\x00PR-Msg02", sess->data(), 0);
+
+			sess->tlvo.add(Hap::Tlv::Type::SessionID, salt + Hap::Crypt::Curve25519::KeySize, ResumeCache::IdSize);
+			sess->tlvo.add(Hap::Tlv::Type::EncryptedData, tag, sizeof(tag));
+
+			// derive new shared secret, it replaces the old one in the cache
+			hkdf.expand("Pair-Resume-Shared-Secret-Info", secret, sizeof(secret));
+
+			_sessionKeys(sess, secret);
+			_resume.Put(salt + Hap::Crypt::Curve25519::KeySize, secret, &ios);
+			memset(secret, 0, sizeof(secret));
+
+			// mark session as secured after response is sent
+			sess->iosRec = ios;
+			sess->ios = &sess->iosRec;
+
+			// adjust content length in response
+			sess->rsp.setContentLength(sess->tlvo.length());
+			return true;
+		}
+
+		// create session encryption keys from Pair Verify shared secret
+		//	both keys are expanded from one extract
+		void Server::_sessionKeys(Session* sess, const uint8_t* secret)
+		{
+			Hap::Crypt::Hkdf hkdf(ControlSalt, secret, Hap::Crypt::Curve25519::KeySize);
+
+			hkdf.expand("Control-Read-Encryption-Key", 
+				sess->AccessoryToControllerKey, sizeof(sess->AccessoryToControllerKey));
+
+			hkdf.expand("Control-Write-Encryption-Key", 
+				sess->ControllerToAccessoryKey, sizeof(sess->ControllerToAccessoryKey));
+		}
+
 		void Server::_pairingAdd(Session* sess)
 		{
 			Tlv::Item id;
 			Tlv::Item key;
 			Controller::Perm perm;
-			const Controller* ios;
+			Controller ios;
 
 			Log("PairingAdd\n");
 
@@ -1268,14 +1916,14 @@ namespace Hap
 				Log("PairingAdd: Identifier not found\n");
 				goto RetErr;
 			}
-			Hex("PairingAdd: Identifier", id.val(), id.len());
+			HexDbg("PairingAdd: Identifier", id.val(), id.len());
 
 			if (!sess->tlvi.get(Tlv::Type::PublicKey, key))
 			{
 				Log("PairingAdd: PublicKey not found\n");
 				goto RetErr;
 			}
-			Hex("PairingAdd: PublicKey", key.val(), key.len());
+			HexDbg("PairingAdd: PublicKey", key.val(), key.len());
 
 			if (!sess->tlvi.get(Tlv::Type::Permissions, perm))
 			{
@@ -1285,11 +1933,10 @@ namespace Hap
 			Log("PairingAdd: Permissions 0x%X\n", perm);
 
 			// locate new controller in pairing db
-			ios = _pairings.Get(id);
-			if (ios != nullptr)
+			if (_pairings.Get(id, ios))
 			{
 				// compare controller LTPK with stored one
-				if (key.len() != Controller::KeyLen || memcmp(key.val(), ios->key, Controller::KeyLen) != 0)
+				if (key.len() != Controller::KeyLen || memcmp(key.val(), ios.key, Controller::KeyLen) != 0)
 				{
 					Log("PairingAdd: mismatch\n");
 					goto RetErr;
@@ -1346,7 +1993,7 @@ namespace Hap
 				Log("PairingRemove: Identifier not found\n");
 				goto RetErr;
 			}
-			Hex("PairingRemove: Identifier", id.val(), id.len());
+			HexDbg("PairingRemove: Identifier", id.val(), id.len());
 
 			if (!_pairings.Remove(id))
 			{
@@ -1368,10 +2015,20 @@ namespace Hap
 			sess->rsp.setContentLength(sess->tlvo.length());
 		}
 
-		void Server::_pairingList(Session* sess)
+		// the list may be larger than response buffer, the response is streamed:
+		//	Content-Length is calculated upfront, the records are added to the response
+		//	buffer and the buffer is sent each time it gets full
+		void Server::_pairingList(Session* sess, Send& send)
 		{
-			bool first = true;
-			bool rc;
+			// TLV length of one pairing record, and of separator between records
+			constexpr uint16_t RecordLen = (2 + Controller::IdLen) + (2 + Controller::KeyLen) + 3;
+			constexpr uint16_t SeparatorLen = 2;
+
+			uint16_t count;
+			uint16_t pos = 0;
+			uint32_t ver;
+			uint32_t length;
+			Controller ios;
 
 			Log("PairingList\n");
 
@@ -1393,33 +2050,62 @@ namespace Hap
 				goto Ret;
 			}
 
-			rc = _pairings.forEach([sess, &first](const Controller* ios) -> bool {
+			// records are copied out one by one and no lock is held while the list is sent,
+			//	the list is abandoned if the pairings change meanwhile
+			count = _pairings.Count(ver);
+			length = sess->tlvo.length() + count * RecordLen + (count > 0 ? (count - 1) * SeparatorLen : 0);
+			if (length > 0xFFFF)
+			{
+				Log("PairingList: response is too big\n");
+				goto RetErr;
+			}
+
+			sess->rsp.contentLength(uint16_t(length));
 
-				if (!first)
+			for (uint16_t n = 0; n < count; n++)
+			{
+				if (!_pairings.Next(pos, ios, ver))
 				{
-					if (!sess->tlvo.add(Hap::Tlv::Type::Separator))
-						return false;
+					Log("PairingList: pairings changed\n");
+					goto RetAbort;
 				}
 
-				if (!sess->tlvo.add(Hap::Tlv::Type::Identifier, ios->id, ios->IdLen))	// TODO: store real ID length (or zero-terminate?)
-					return false;
+				// flush the response if the record does not fit
+				if (sess->tlvo.available() < SeparatorLen + RecordLen)
+				{
+					sess->rsp.append(sess->tlvo.length());
+					if (!_send(sess, send))
+						goto RetAbort;
 
-				if (!sess->tlvo.add(Hap::Tlv::Type::PublicKey, ios->key, ios->KeyLen))
-					return false;
+					sess->rsp.restart();
+					sess->tlvo.create((uint8_t*)sess->rsp.data(), sess->rsp.size());
+				}
 
-				if (!sess->tlvo.add(Hap::Tlv::Type::Permissions, ios->perm))
-					return false;
+				if (n > 0 && !sess->tlvo.add(Hap::Tlv::Type::Separator))
+					goto RetOverflow;
 
-				first = false;
+				if (!sess->tlvo.add(Hap::Tlv::Type::Identifier, ios.id, ios.IdLen))	// TODO: store real ID length (or zero-terminate?)
+					goto RetOverflow;
 
-				return true;
-			});
+				if (!sess->tlvo.add(Hap::Tlv::Type::PublicKey, ios.key, ios.KeyLen))
+					goto RetOverflow;
 
-			if(rc)
-				goto Ret;
+				if (!sess->tlvo.add(Hap::Tlv::Type::Permissions, ios.perm))
+					goto RetOverflow;
+			}
 
-		//RetErr:	// error
+			// the rest of the list is sent by the caller
+			sess->rsp.append(sess->tlvo.length());
+			return;
+
+		RetOverflow:
 			Log("PairingList: TLV overflow\n");
+
+		RetAbort:
+			// part of the response could be sent already, the connection is closed
+			//	when the controller sees Content-Length mismatch
+
+		RetErr:	// error
 			sess->tlvo.add(Hap::Tlv::Type::Error, Hap::Tlv::Error::Unknown);
 
 		Ret:
@@ -68,6 +68,7 @@ namespace Hap
 		{
 			ContentType,
 			ContentLength,
+			TransferEncoding,
 
 			HeaderMax
 		};
@@ -76,7 +77,8 @@ namespace Hap
 			static const char* const str[] =
 			{
 				"Content-Type",
-				"Content-Length"
+				"Content-Length",
+				"Transfer-Encoding"
 			};
 			return str[int(h)];
 		}
@@ -102,6 +104,7 @@ namespace Hap
 			size_t _buflen;
 			size_t _prevbuflen;
 			int _minor_version;
+			bool _parsed;		// headers are parsed, only body is being received
 
 		public:
 			enum Status
@@ -120,6 +123,7 @@ namespace Hap
 				_num_headers = 0;
 				_buflen = 0;
 				_prevbuflen = 0;
+				_parsed = false;
 			}
 
 			char* buf()
@@ -134,8 +138,16 @@ namespace Hap
 
 			// parse buffer, maybe called multiple times as more data is read into the buffer
 			//	the buflen must indicate current length of valid data in the buffer
+			//	once the headers are parsed, following calls only extend the data
 			Status parse(size_t buflen)
 			{
+				if (_parsed)
+				{
+					_data_len += buflen - _buflen;
+					_buflen = buflen;
+					return Success;
+				}
+
 				_prevbuflen = _buflen;
 				_buflen = buflen;
 				_num_headers = sizeofarr(_headers);
@@ -148,6 +160,7 @@ namespace Hap
 				{
 					_data = (uint8_t*)_buf + rc;
 					_data_len = _buflen - rc;
+					_parsed = true;
 					return Success;
 				}
 				
@@ -172,6 +185,16 @@ namespace Hap
 				return makeBuf(_data, _data_len);
 			}
 
+			// limit the body to body_len bytes, the rest belongs to next pipelined request
+			//	returns length of the request with headers and body
+			size_t complete(size_t body_len)
+			{
+				if (_data_len > body_len)
+					_data_len = body_len;
+
+				return (_data - (uint8_t*)_buf) + _data_len;
+			}
+
 			size_t hdr_count()
 			{
 				return _num_headers;
@@ -253,6 +276,8 @@ namespace Hap
 			{
 				_buf = buf;
 				_max = size;
+				_len = 0;
+				_len_pos = 0;
 			}
 
 			// return response buffer
@@ -303,9 +328,9 @@ namespace Hap
 
 				int l = 0;
 
-				l = snprintf(_buf + _len, _max, "%s: %4d\r\n", HeaderStr(h), prm);
+				l = snprintf(_buf + _len, _max, "%s: %5d\r\n", HeaderStr(h), prm);
 				_len += l;
-				_max -= _len;
+				_max -= l;
 
 				if (h == ContentLength)
 				{
@@ -318,15 +343,38 @@ namespace Hap
 			// add length of data area
 			//	assumes that _len_pos was saved by prevous call to add(ConteneLength,0)
 			void setContentLength(uint16_t len)
+			{
+				contentLength(len);
+
+				_len += len;
+			}
+
+			// set Content-Length header value without adding data, 
+			//	used when data is streamed in parts through append/restart
+			void contentLength(uint16_t len)
 			{
 				if (_len_pos == 0)
 					return;
 
 				char t = _buf[_len_pos];
-				snprintf(_buf + _len_pos - 4, 5, "%4d", len);
+				snprintf(_buf + _len_pos - 5, 6, "%5d", len);
 				_buf[_len_pos] = t;
+			}
 
+			// add len bytes which were written into data area
+			void append(uint16_t len)
+			{
 				_len += len;
+				_max -= len;
+			}
+
+			// start filling the buffer from the beginning, 
+			//	called after previous part of streamed response was sent
+			void restart()
+			{
+				_max += _len;
+				_len = 0;
+				_len_pos = 0;
 			}
 
 			bool add(Header h, const char* prm)
@@ -337,7 +385,7 @@ namespace Hap
 				int l = 0;
 				l = snprintf(_buf + _len, _max, "%s: %s\r\n", HeaderStr(h), prm);
 				_len += l;
-				_max -= _len;
+				_max -= l;
 				return _max != 0;
 			}
 
@@ -370,8 +418,52 @@ namespace Hap
 			}
 		};
 
+		// Pair Resume cache
+		//	keeps shared secrets of recent Pair Verify sessions under session ID, 
+		//	so a returning controller is re-keyed with HKDF instead of full Pair Verify
+		//	entries are used once and expire after ttl seconds, all methods are thread-safe
+		class ResumeCache
+		{
+		public:
+			constexpr static uint8_t IdSize = 8;		// size of session ID
+			constexpr static uint8_t SecretSize = 32;	// size of shared secret
+
+			// set lifetime of entries in seconds, 0 disables the cache
+			void Ttl(uint32_t ttl);
+
+			// store shared secret of verified controller, replaces the oldest entry when full
+			void Put(const uint8_t* id, const uint8_t* secret, const Controller* ios);
+
+			// find and remove entry
+			//	returns false if not found or expired
+			bool Take(const uint8_t* id, uint8_t* secret, Controller::Id& iosId, uint8_t& iosIdLen);
+
+		private:
+			using Clock = std::chrono::steady_clock;
+
+			struct Entry
+			{
+				bool used;
+				Clock::time_point time;			// time of Put
+				uint8_t id[IdSize];
+				uint8_t secret[SecretSize];
+				uint8_t iosIdLen;
+				Controller::Id iosId;
+			};
+
+			Entry _entry[MaxResumeSessions] = {};
+			uint32_t _ttl = ResumeTtl;
+			std::mutex _mtx;
+
+			bool _expired(const Entry& e, Clock::time_point now);
+		};
+
 		// Http Server object
-		//	- all access to Http Server object must be externally serialized
+		//	- when created with single Buf, all sessions share the same buffers and 
+		//		all access to Http Server object must be externally serialized
+		//	- when created with a pool of Bufs, each opened session gets its own buffers
+		//		and different sessions may be processed concurrently from different threads;
+		//		calls for the same session must still be serialized by the caller
 		class Server
 		{
 		public:
@@ -380,15 +472,27 @@ namespace Hap
 				Hap::Buf<char*> req;	// request buffer MaxHttpFrame*N where N depends on expected request size
 				Hap::Buf<char*> rsp;	// response buffer  MaxHttpFrame*M where M depends on expected response size
 				Hap::Buf<char*> tmp;	// temporary storage (encrypt/decrypt etc.), MaxHttpFrame
-
+				Hap::Buf<char*> out;	// output queue, sealed frames (or plain response) not accepted by the socket yet,
+										//	MaxHttpFrame*(M+1) or more keeps the whole response and some events;
+										//	when not set tmp is used, one frame at a time, and send must accept all data.
+										//	Up to 64K; while it is more than half full, pipelined requests and events
+										//	wait for the socket to drain. Response that does not fit the queue and 
+										//	the socket buffer closes the connection, so size it from the largest 
+										//	streamed response (GET /accessories, pairings list)
 
 			};
 
 		private:
-			Buf& _buf;
+			Buf* _buf;						// buffer pool
+			uint8_t _bufCount;				// number of buffers in the pool, 1 - shared by all sessions
+			bool _bufUsed[MaxHttpSessions];
+			std::mutex _mtx;				// protects session open/close and buffer pool
+
 			Db& _db;						// accessory database
 			Pairings& _pairings;			// pairings database
 			Hap::Crypt::Ed25519& _keys;		// crypto keys
+			Hap::Srp::Verifier& _srp;		// SRP salt and verifier of the setup code
+			ResumeCache _resume;			// Pair Resume sessions
 
 			class Session					// sessions
 			{
@@ -401,16 +505,28 @@ namespace Hap
 				
 				// session-wide data
 				Hap::Crypt::Curve25519 curve;		// Session securiry keys (used on Pair Verivication phase)
-				const Controller* ios;				// paired iOS device
+				const Controller* ios;				// paired iOS device, points to iosRec once verified
+				Controller iosRec;					// copy of its pairing record
 				bool secured;						// session is secured
 				uint8_t AccessoryToControllerKey[32];
 				uint8_t ControllerToAccessoryKey[32];
 				uint64_t recvSeq;
 				uint64_t sendSeq;
+
+				// request receive state, kept between Process calls until the request is complete
+				uint16_t recvLen;					// received encrypted data not decrypted yet, in data()
+				uint16_t httpLen;					// length of HTTP request received so far
+
+				// output queue state, data in out() from outHead to outTail waits for the socket
+				uint16_t outHead;
+				uint16_t outTail;
+				bool closing;						// output stream is broken, next Process closes the connection
 				
 				// session temp data
 				uint8_t key[32];
 
+				std::mutex mtx;						// serializes request processing and event polling
+
 				void Open(sid_t sid, Buf* buf)
 				{
 					_sid = sid;
@@ -420,21 +536,38 @@ namespace Hap
 					secured = false;
 					recvSeq = 0;
 					sendSeq = 0;
+					recvLen = 0;
+					httpLen = 0;
+					outHead = 0;
+					outTail = 0;
+					closing = false;
 				}
 
 				void Close()
 				{
 					_opened = false;
 					_sid = sid_invalid;
+					_buf = nullptr;
 					ios = nullptr;
 					secured = false;
 				}
 
+				Buf* buf()
+				{
+					return _buf;
+				}
+
 				bool isOpen()
 				{
 					return _opened;
 				}
 
+				// true while part of request is received, request buffers must not be reused
+				bool receiving()
+				{
+					return recvLen != 0 || httpLen != 0;
+				}
+
 				void Init(
 				)
 				{
@@ -459,6 +592,38 @@ namespace Hap
 					return (uint16_t)_buf->tmp.len();
 				}
 
+				uint8_t* out()
+				{
+					if (_buf->out.len() == 0)
+						return data();
+					return (uint8_t*)_buf->out.ptr();
+				}
+
+				uint16_t sizeofout()
+				{
+					if (_buf->out.len() == 0)
+						return sizeofdata();
+					return (uint16_t)_buf->out.len();
+				}
+
+				// true if output buffer is set, output can stay queued between calls
+				//	unless the buffers are shared by all sessions
+				bool queue()
+				{
+					return _buf->out.len() != 0;
+				}
+
+				// output queue is more than half full, the controller does not keep up
+				bool congested()
+				{
+					return queued() > sizeofout() / 2;
+				}
+
+				uint16_t queued()
+				{
+					return outTail - outHead;
+				}
+
 			private:
 				// the following fields are valid from session open to close
 				bool _opened = false;		// true when session is opened
@@ -467,14 +632,32 @@ namespace Hap
 			} _sess[MaxHttpSessions + 1];	// last slot is for handling 'too many sessions' condition
 
 		public:
+			// Recv returns number of bytes received, 0 when connection is closed, 
+			//	RecvAgain when no data is available now, or other negative value on error
 			using Recv = std::function<int(sid_t sid, char* buf, uint16_t size)>;
+			constexpr static int RecvAgain = -2;
+
+			// Send returns number of bytes accepted, which may be less than len, 
+			//	0 when the socket cannot accept data now, or negative value on error
 			using Send = std::function<int(sid_t sid, char* buf, uint16_t len)>;
 
 
-			Server(Buf& buf, Db& db, Pairings& pairings, Hap::Crypt::Ed25519& keys)
-				: _buf(buf), _db(db), _pairings(pairings), _keys(keys)
+			// create server with single buffer shared by all sessions
+			Server(Buf& buf, Db& db, Pairings& pairings, Hap::Crypt::Ed25519& keys, Hap::Srp::Verifier& srp)
+				: _buf(&buf), _bufCount(1), _db(db), _pairings(pairings), _keys(keys), _srp(srp)
 			{}
 
+			// create server with pool of buffers, one buffer is used by each opened session
+			//	count must not exceed MaxHttpSessions
+			Server(Buf* buf, uint8_t count, Db& db, Pairings& pairings, Hap::Crypt::Ed25519& keys, Hap::Srp::Verifier& srp)
+				: _buf(buf), _bufCount(count), _db(db), _pairings(pairings), _keys(keys), _srp(srp)
+			{
+				if (_bufCount > sizeofarr(_bufUsed))
+					_bufCount = sizeofarr(_bufUsed);
+				for (unsigned i = 0; i < sizeofarr(_bufUsed); i++)
+					_bufUsed[i] = false;
+			}
+
 			// Open - returns new session ID, 0..sid_max, or sid_invalid
 			//	the caller (network task) calls Open when new TCP connection request arrives
 			//	when sid_invalid is returned, the caller should still call Process
@@ -490,23 +673,61 @@ namespace Hap
 			// Process - process incoming HTTP request
 			//	must be called from network task when data for this session is available
 			//	the function: 
-			//		- calls 'recv' one or more times until complete HTTP request is arrived
+			//		- calls 'recv' one or more times until complete HTTP request is arrived,
+			//			recv may block, or return RecvAgain when no data is available
 			//			when recv error or data timeout is detected the caller returns false 
 			//			and disconnects the TCP session 
+			//		- when recv returns RecvAgain the received part of the request is kept 
+			//			in the session and true is returned, the request is continued
+			//			on next call, so non-blocking recv never stalls the network task
 			//		- processes the request and creates response
-			//		- calls 'send' to send the response back
+			//		- pipelined requests already received are processed in turn, their responses 
+			//			are queued and sent together before recv is called again, and the function
+			//			returns once no received data is left, partial request is kept as above
+			//		- calls 'send' to send the response back, data not accepted by the socket
+			//			stays in the session output queue and is sent first on next call,
+			//			so Process must also be called when the socket becomes writable 
+			//			while Pending returns true
+			//		- never waits for the socket: while more than half of the output queue is used,
+			//			remaining pipelined requests are kept and no more data is read, the caller 
+			//			should not call Process again until the socket becomes writable;
+			//			response that does not fit the queue closes the connection
 			//			buf is send to nullptr if response buffer is too small
 			//		-	returns true to keep the connection open
 			//		-	returns false to close the TCP connection
 			bool Process(sid_t sid,	Recv recv, Send send);
 
 			// Poll database (collect events)
-			//	the network task must call this periodically (once every 1..n sec)
-			//	for all opened sessions so events get delivered to all connected controllers
+			//	the network task must call this for all opened sessions when notified through
+			//	onEvent callback (or periodically) so events get delivered to all connected controllers
+			//	the session which is being processed concurrently or has partially 
+			//	received request is skipped, its events are delivered on next Poll
+			//	while more than half of the output queue is used, events are held back
+			//	and coalesced, so slow controller does not grow the backlog
 			void Poll(sid_t sid, Send send);
 
+			// returns true if session has queued output waiting for the socket to become writable,
+			//	or must be closed by Process
+			bool Pending(sid_t sid);
+
+			// set event notification callback
+			//	the callback is called in context of the thread which changed characteristic value,
+			//	it should wake up the network task which then calls Poll
+			void onEvent(std::function<void()> cb);
+
+			// Pair Resume - set lifetime of cached Pair Verify sessions in seconds
+			//	0 disables resume, controllers always go through full Pair Verify
+			void Resume(uint32_t ttl)
+			{
+				_resume.Ttl(ttl);
+			}
+
 		private:
-			bool _send(Session* sess, Send& send);
+			Buf* _bufAcquire();
+			void _bufRelease(Buf* buf);
+
+			bool _send(Session* sess, Send& send, bool flush = true);
+			bool _flush(Session* sess, Send& send);
 			
 			void _pairSetup1(Session* sess);
 			void _pairSetup3(Session* sess);
@@ -514,10 +735,12 @@ namespace Hap
 			
 			void _pairVerify1(Session* sess);
 			void _pairVerify3(Session* sess);
+			bool _pairResume1(Session* sess);
+			void _sessionKeys(Session* sess, const uint8_t* secret);
 			
 			void _pairingAdd(Session* sess);
 			void _pairingRemove(Session* sess);
-			void _pairingList(Session* sess);
+			void _pairingList(Session* sess, Send& send);
 		};
 	}
 }
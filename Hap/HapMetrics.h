@@ -0,0 +1,340 @@
+/*
+MIT License
+
+Copyright (c) 2018 Gera Kazakov
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef _HAP_METRICS_H_
+#define _HAP_METRICS_H_
+
+// Runtime metrics - counters and latency histograms
+//	updated with relaxed atomics, so the hot path pays a few uncontended adds.
+//	The data block can be moved to named shared memory (system-dependent Share),
+//	then other process maps it with Open and prints the snapshot
+
+namespace Hap
+{
+	namespace Metrics
+	{
+		enum Counter : uint8_t
+		{
+			SessionOpen,		// HTTP sessions opened
+			SessionClose,		// HTTP sessions closed
+			SessionReject,		// no free session or session buffers
+			AeadOpenBytes,		// bytes decrypted in secured sessions
+			AeadSealBytes,		// bytes encrypted in secured sessions
+			AeadError,			// frames failed to decrypt
+			PollCount,			// Poll calls on secured sessions
+			PollEvents,			// event notifications sent by Poll
+			QueueOverflow,		// sessions closed on output queue overflow
+			CounterCount
+		};
+
+		enum Hist : uint8_t
+		{
+			// Server::Process per route, from complete request to queued response
+			RouteIdentify,
+			RoutePairSetup,
+			RoutePairVerify,
+			RoutePairings,
+			RouteAccessories,
+			RouteCharRead,
+			RouteCharWrite,
+			RouteOther,
+
+			// pairing phases
+			PairSetupM1,
+			PairSetupM3,
+			PairSetupM5,
+			PairVerifyM1,
+			PairVerifyM3,
+			PairResumeM1,
+
+			HistCount
+		};
+
+		static inline const char* Name(Counter c)
+		{
+			static const char* name[] =
+			{
+				"SessionOpen",
+				"SessionClose",
+				"SessionReject",
+				"AeadOpenBytes",
+				"AeadSealBytes",
+				"AeadError",
+				"PollCount",
+				"PollEvents",
+				"QueueOverflow",
+			};
+			static_assert(sizeofarr(name) == CounterCount, "counter names");
+
+			return name[c];
+		}
+
+		static inline const char* Name(Hist h)
+		{
+			static const char* name[] =
+			{
+				"POST /identify",
+				"POST /pair-setup",
+				"POST /pair-verify",
+				"POST /pairings",
+				"GET /accessories",
+				"GET /characteristics",
+				"PUT /characteristics",
+				"other",
+				"PairSetupM1",
+				"PairSetupM3",
+				"PairSetupM5",
+				"PairVerifyM1",
+				"PairVerifyM3",
+				"PairResumeM1",
+			};
+			static_assert(sizeofarr(name) == HistCount, "histogram names");
+
+			return name[h];
+		}
+
+		// latency histogram, values in microseconds
+		//	HDR-style log-linear buckets: values below 2^SubBits have own buckets,
+		//	above that each power of 2 is split into 2^SubBits buckets (relative error < 12.5%)
+		struct Histogram
+		{
+			constexpr static uint8_t SubBits = 3;
+			constexpr static uint8_t MaxExp = 27;		// ~134 s, longer values go to the last bucket
+			constexpr static uint16_t Buckets = (MaxExp - SubBits + 2) << SubBits;
+
+			std::atomic<uint64_t> count;
+			std::atomic<uint64_t> sum;
+			std::atomic<uint64_t> max;
+			std::atomic<uint64_t> bucket[Buckets];
+
+			void Add(uint64_t v)
+			{
+				count.fetch_add(1, std::memory_order_relaxed);
+				sum.fetch_add(v, std::memory_order_relaxed);
+				bucket[index(v)].fetch_add(1, std::memory_order_relaxed);
+
+				uint64_t m = max.load(std::memory_order_relaxed);
+				while (v > m && !max.compare_exchange_weak(m, v, std::memory_order_relaxed));
+			}
+
+			// upper bound of the bucket holding given percentile of values, 0 when empty
+			uint64_t Percentile(double pct) const
+			{
+				uint64_t total = 0;
+				for (uint16_t i = 0; i < Buckets; i++)
+					total += bucket[i].load(std::memory_order_relaxed);
+
+				if (total == 0)
+					return 0;
+
+				uint64_t rank = (uint64_t)(total * pct / 100);
+				if (rank >= total)
+					rank = total - 1;
+
+				uint64_t cnt = 0;
+				for (uint16_t i = 0; i < Buckets; i++)
+				{
+					cnt += bucket[i].load(std::memory_order_relaxed);
+					if (cnt > rank)
+						return upper(i);
+				}
+
+				return upper(Buckets - 1);
+			}
+
+			static uint16_t index(uint64_t v)
+			{
+				if (v < (1u << SubBits))
+					return (uint16_t)v;
+
+				// position of the highest bit
+#ifdef __GNUC__
+				uint8_t e = 63 - __builtin_clzll(v);
+#else
+				uint8_t e = SubBits;
+				while (e < 63 && (v >> (e + 1)) != 0)
+					e++;
+#endif
+				if (e > MaxExp)
+					return Buckets - 1;
+
+				return ((e - SubBits + 1) << SubBits) + ((v >> (e - SubBits)) & ((1 << SubBits) - 1));
+			}
+
+			static uint64_t upper(uint16_t i)
+			{
+				if (i < (1u << SubBits))
+					return i;
+
+				uint8_t e = (i >> SubBits) + SubBits - 1;
+				uint64_t sub = i & ((1 << SubBits) - 1);
+
+				return (((1ull << SubBits) + sub + 1) << (e - SubBits)) - 1;
+			}
+		};
+
+		// metrics data block, zero-initialized
+		struct Data
+		{
+			constexpr static uint32_t Magic = 0x4D706148;	// "HapM"
+			constexpr static uint32_t Version = 1;			// increment on layout change
+
+			uint32_t magic;
+			uint32_t version;
+			uint32_t size;				// sizeof(Data)
+			std::atomic<uint64_t> counter[CounterCount];
+			Histogram hist[HistCount];
+		};
+
+		class Registry
+		{
+		public:
+			static Registry& Instance()
+			{
+				static Registry reg;
+				return reg;
+			}
+
+			void Add(Counter c, uint64_t v = 1)
+			{
+				_data->counter[c].fetch_add(v, std::memory_order_relaxed);
+			}
+
+			void Time(Hist h, uint64_t us)
+			{
+				_data->hist[h].Add(us);
+			}
+
+			const Data& Get() const
+			{
+				return *_data;
+			}
+
+			// system-dependent, must be called before the servers start
+			//	move the data to named shared memory, returns false if it cannot be created
+			bool Share(const char* name);
+
+			// system-dependent
+			//	map the data shared by other process, read-only
+			//	returns nullptr if it does not exist or has different layout
+			static const Data* Open(const char* name);
+
+			static void Print(const Data& data, FILE* f = stdout)
+			{
+				for (uint8_t c = 0; c < CounterCount; c++)
+					fprintf(f, "%-22s %llu\n", Name(Counter(c)),
+						(unsigned long long)data.counter[c].load(std::memory_order_relaxed));
+
+				fprintf(f, "%-22s %10s %8s %8s %8s %8s %8s %8s  (us)\n", "", "count", "avg", "p50", "p90", "p99", "p99.9", "max");
+
+				for (uint8_t h = 0; h < HistCount; h++)
+				{
+					const Histogram& hist = data.hist[h];
+					uint64_t count = hist.count.load(std::memory_order_relaxed);
+					uint64_t max = hist.max.load(std::memory_order_relaxed);
+
+					if (count == 0)
+						continue;
+
+					// bucket bound may be above the largest value
+					auto pct = [&hist, max](double p) -> unsigned long long {
+						uint64_t v = hist.Percentile(p);
+						return v < max ? v : max;
+					};
+
+					fprintf(f, "%-22s %10llu %8llu %8llu %8llu %8llu %8llu %8llu\n", Name(Hist(h)),
+						(unsigned long long)count,
+						(unsigned long long)(hist.sum.load(std::memory_order_relaxed) / count),
+						pct(50), pct(90), pct(99), pct(99.9),
+						(unsigned long long)max);
+				}
+			}
+
+		private:
+			Data _local;
+			Data* _data = &_local;
+
+			Registry()
+			{
+				_local.magic = Data::Magic;
+				_local.version = Data::Version;
+				_local.size = sizeof(Data);
+			}
+
+			// copy current values into new data block
+			static void _copy(Data& dst, const Data& src)
+			{
+				dst.magic = src.magic;
+				dst.version = src.version;
+				dst.size = src.size;
+
+				for (uint8_t c = 0; c < CounterCount; c++)
+					dst.counter[c].store(src.counter[c].load(std::memory_order_relaxed), std::memory_order_relaxed);
+
+				for (uint8_t h = 0; h < HistCount; h++)
+				{
+					const Histogram& s = src.hist[h];
+					Histogram& d = dst.hist[h];
+
+					d.count.store(s.count.load(std::memory_order_relaxed), std::memory_order_relaxed);
+					d.sum.store(s.sum.load(std::memory_order_relaxed), std::memory_order_relaxed);
+					d.max.store(s.max.load(std::memory_order_relaxed), std::memory_order_relaxed);
+
+					for (uint16_t i = 0; i < Histogram::Buckets; i++)
+						d.bucket[i].store(s.bucket[i].load(std::memory_order_relaxed), std::memory_order_relaxed);
+				}
+			}
+		};
+
+		static inline void Count(Counter c, uint64_t v = 1)
+		{
+			Registry::Instance().Add(c, v);
+		}
+
+		// measures the time until end of scope
+		class Timer
+		{
+		public:
+			Timer(Hist h) : _h(h), _start(std::chrono::steady_clock::now()) {}
+
+			~Timer()
+			{
+				auto us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - _start);
+				Registry::Instance().Time(_h, us.count());
+			}
+
+			// change the histogram, when the route becomes known
+			void Set(Hist h)
+			{
+				_h = h;
+			}
+
+		private:
+			Hist _h;
+			std::chrono::steady_clock::time_point _start;
+		};
+	}
+}
+
+#endif
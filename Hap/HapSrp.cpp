@@ -22,7 +22,7 @@ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
 SOFTWARE.
 */
 
-#include "HapSrp.h"
+#include "Hap.h"
 
 const unsigned char srp_modulus[] = {
 	0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
@@ -88,6 +88,60 @@ int sizeof_srp_generator = sizeof(srp_generator);
 // tommath-mpi
 #include "mpi.c"
 
+namespace Hap
+{
+	namespace Srp
+	{
+		bool Verifier::Init(const char* setupCode)
+		{
+			SRP* srp = NULL;
+			bool ret = false;
+
+			_size = 0;
+
+			if (strlen(setupCode) > CodeSize)
+			{
+				Log("Srp: invalid setup code\n");
+				goto Ret;
+			}
+
+			srp = SRP_new(SRP6a_server_method());
+			if (srp == NULL)
+				goto Ret;
+
+			t_random(_salt, SaltSize);
+
+			if (SRP_set_username(srp, "Pair-Setup") != SRP_SUCCESS)
+				goto Ret;
+
+			if (SRP_set_params(srp,
+				srp_modulus, sizeof_srp_modulus,
+				srp_generator, sizeof_srp_generator,
+				_salt, SaltSize) != SRP_SUCCESS)
+				goto Ret;
+
+			if (SRP_set_auth_password(srp, setupCode) != SRP_SUCCESS)
+				goto Ret;
+
+			if (BigIntegerByteLen(srp->verifier) > MaxSize)
+				goto Ret;
+
+			_size = (uint16_t)BigIntegerToBytes(srp->verifier, _v, MaxSize);
+			strcpy(_code, setupCode);
+			ret = true;
+
+		Ret:
+			if (srp != NULL)
+				SRP_free(srp);
+
+			if (!ret)
+				Log("Srp: verifier init error\n");
+
+			return ret;
+		}
+	}
+}
+
 //#define SRP_TEST
 #ifdef SRP_TEST
 
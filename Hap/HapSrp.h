@@ -29,6 +29,49 @@ SOFTWARE.
 
 namespace Hap
 {
+	namespace Srp
+	{
+		// SRP salt and verifier of the setup code
+		//	v = g^x mod N is a full size modular exponentiation which depends only on
+		//	the setup code, so it is computed once and saved with the config
+		class Verifier
+		{
+		public:
+			static constexpr uint8_t SaltSize = 16;
+			static constexpr uint16_t MaxSize = 384;	// 3072-bit modulus
+			static constexpr uint8_t CodeSize = 10;		// XXX-XX-XXX
+
+			// generate new salt and compute verifier for the setup code
+			bool Init(const char* setupCode);
+
+			// true when verifier is computed for this setup code
+			bool Valid(const char* setupCode) const
+			{
+				return _size != 0 && strcmp(_code, setupCode) == 0;
+			}
+
+			const uint8_t* Salt() const
+			{
+				return _salt;
+			}
+
+			const uint8_t* Data() const
+			{
+				return _v;
+			}
+
+			uint16_t Size() const
+			{
+				return _size;
+			}
+
+		protected:
+			char _code[CodeSize + 1] = {};
+			uint8_t _salt[SaltSize];
+			uint8_t _v[MaxSize];
+			uint16_t _size = 0;
+		};
+	}
 }
 
 extern const unsigned char srp_modulus[];
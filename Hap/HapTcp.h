@@ -33,8 +33,12 @@ namespace Hap
 	{
 	protected:
 		Hap::Http::Server* _http;
+		unsigned _workers = 0;
 	public:
-		static Tcp* Create(Hap::Http::Server* _http);
+		// create TCP server
+		//	workers - number of threads processing HTTP sessions, 
+		//	0 - all sessions are processed by the network thread
+		static Tcp* Create(Hap::Http::Server* _http, unsigned workers = 0);
 		virtual bool Start() = 0;
 		virtual void Stop() = 0;
 	};
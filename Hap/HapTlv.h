@@ -39,6 +39,7 @@ namespace Hap
 			AddPairing = 3,
 			RemovePairing = 4,
 			ListPairing = 5,
+			PairResume = 6,
 		};
 
 		enum class State : uint8_t
@@ -79,6 +80,7 @@ namespace Hap
 			Permissions = 0x0B,		//	integer
 			FragmentData = 0x0C,	//	bytes
 			Fragmentlast = 0x0D,	//	bytes
+			SessionID = 0x0E,		//	bytes
 			Separator = 0xFF,		//	null
 			Invalid = 0xFE
 		};
@@ -282,6 +284,12 @@ namespace Hap
 				return _len;
 			}
 
+			// space left in the buffer
+			uint16_t available()
+			{
+				return _size - _len;
+			}
+
 			// add zero-size item
 			bool add(Type t)
 			{
@@ -31,6 +31,22 @@ void chacha20_block(unsigned char *out, const unsigned char key[32],
 void chacha20_encrypt(unsigned char *out, const unsigned char *in, size_t len,
     const unsigned char key[32], const unsigned char nonce[12]);
 
+/* AEAD keystream: returns block 0 in otk, encrypts in with blocks 1.. (chacha20-simd.c) */
+void chacha20_aead(unsigned char *out, unsigned char otk[32], const unsigned char *in, size_t len,
+    const unsigned char key[32], const unsigned char nonce[12]);
+
+/* AEAD keystream for count messages, message i uses nonce with 64-bit counter
+   at nonce + 4 increased by i, blocks of all messages share the vector lanes (chacha20-simd.c) */
+void chacha20_aead_frames(unsigned char *const out[], unsigned char (*otk)[32], const unsigned char *const in[],
+    const size_t len[], size_t count, const unsigned char key[32], const unsigned char nonce[12]);
+
+/* raw keystream, blocks 0..blocks-1 (chacha20-simd.c) */
+void chacha20_keystream(unsigned char *ks, size_t blocks, const unsigned char key[32],
+    const unsigned char nonce[12]);
+
+/* name of keystream kernel selected at runtime */
+const char* chacha20_impl(void);
+
 #ifdef  __cplusplus
 }
 #endif
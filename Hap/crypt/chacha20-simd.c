@@ -0,0 +1,434 @@
+/*
+ChaCha20 (RFC 7539, 96-bit nonce) multi-block keystream.
+Public domain.
+
+Keystream is generated 8 blocks at a time by AVX2 kernel, 4 blocks by SSE2 kernel,
+or one block by portable code. The kernel is selected at runtime from CPUID.
+Counter and nonce are set per block (lane), so one batch can hold blocks of
+different messages.
+Block 0 of the keystream is returned as Poly1305 one-time key, message is
+encrypted starting at block 1, as required by AEAD construction.
+*/
+
+#include <stdint.h>
+#include <string.h>
+#include "chacha.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define CHACHA20_X86
+#define CHACHA20_TARGET(t) __attribute__((target(t)))
+#include <immintrin.h>
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#define CHACHA20_X86
+#define CHACHA20_TARGET(t)
+#include <intrin.h>
+#include <immintrin.h>
+#endif
+
+#define CHACHA20_BATCH 8	/* max number of blocks generated in one call */
+
+#define CHACHA20_LOAD32(p) \
+	(((uint32_t)((p)[0])) | ((uint32_t)((p)[1]) << 8) | \
+	 ((uint32_t)((p)[2]) << 16) | ((uint32_t)((p)[3]) << 24))
+
+#define CHACHA20_LOAD64(p) \
+	((uint64_t)CHACHA20_LOAD32(p) | ((uint64_t)CHACHA20_LOAD32((p) + 4) << 32))
+
+/* state words 12..15 (counter and nonce) of each block, one column per lane */
+typedef uint32_t chacha20_lanes[4][CHACHA20_BATCH];
+
+#define CHACHA20_ROTL(v, n) (((v) << (n)) | ((v) >> (32 - (n))))
+
+#define CHACHA20_QR(a, b, c, d) \
+	a += b; d = CHACHA20_ROTL(d ^ a, 16); \
+	c += d; b = CHACHA20_ROTL(b ^ c, 12); \
+	a += b; d = CHACHA20_ROTL(d ^ a, 8); \
+	c += d; b = CHACHA20_ROTL(b ^ c, 7);
+
+/* portable kernel, one block of lane j */
+static void chacha20_ks1(unsigned char *ks, const uint32_t st[16], const chacha20_lanes ln, unsigned j)
+{
+	uint32_t s[16];
+	uint32_t x[16];
+	int i;
+
+	memcpy(s, st, sizeof(s));
+	for (i = 0; i < 4; i++)
+		s[12 + i] = ln[i][j];
+	memcpy(x, s, sizeof(x));
+
+	for (i = 0; i < 10; i++)
+	{
+		CHACHA20_QR(x[0], x[4], x[8], x[12]);
+		CHACHA20_QR(x[1], x[5], x[9], x[13]);
+		CHACHA20_QR(x[2], x[6], x[10], x[14]);
+		CHACHA20_QR(x[3], x[7], x[11], x[15]);
+		CHACHA20_QR(x[0], x[5], x[10], x[15]);
+		CHACHA20_QR(x[1], x[6], x[11], x[12]);
+		CHACHA20_QR(x[2], x[7], x[8], x[13]);
+		CHACHA20_QR(x[3], x[4], x[9], x[14]);
+	}
+
+	for (i = 0; i < 16; i++)
+	{
+		uint32_t v = x[i] + s[i];
+		ks[4 * i + 0] = (unsigned char)(v);
+		ks[4 * i + 1] = (unsigned char)(v >> 8);
+		ks[4 * i + 2] = (unsigned char)(v >> 16);
+		ks[4 * i + 3] = (unsigned char)(v >> 24);
+	}
+}
+
+#ifdef CHACHA20_X86
+
+/*
+ * Vector kernels keep word i of all blocks in one register, lane j is block j.
+ * After the rounds, groups of four words are transposed into blocks.
+ */
+
+#define CHACHA20_VQR(vadd, vxor, vrotl, a, b, c, d) \
+	a = vadd(a, b); d = vrotl(vxor(d, a), 16); \
+	c = vadd(c, d); b = vrotl(vxor(b, c), 12); \
+	a = vadd(a, b); d = vrotl(vxor(d, a), 8); \
+	c = vadd(c, d); b = vrotl(vxor(b, c), 7);
+
+#define CHACHA20_VROUNDS(vadd, vxor, vrotl, x) \
+	for (i = 0; i < 10; i++) \
+	{ \
+		CHACHA20_VQR(vadd, vxor, vrotl, x[0], x[4], x[8], x[12]); \
+		CHACHA20_VQR(vadd, vxor, vrotl, x[1], x[5], x[9], x[13]); \
+		CHACHA20_VQR(vadd, vxor, vrotl, x[2], x[6], x[10], x[14]); \
+		CHACHA20_VQR(vadd, vxor, vrotl, x[3], x[7], x[11], x[15]); \
+		CHACHA20_VQR(vadd, vxor, vrotl, x[0], x[5], x[10], x[15]); \
+		CHACHA20_VQR(vadd, vxor, vrotl, x[1], x[6], x[11], x[12]); \
+		CHACHA20_VQR(vadd, vxor, vrotl, x[2], x[7], x[8], x[13]); \
+		CHACHA20_VQR(vadd, vxor, vrotl, x[3], x[4], x[9], x[14]); \
+	}
+
+#define CHACHA20_ROTL128(v, n) _mm_or_si128(_mm_slli_epi32(v, n), _mm_srli_epi32(v, 32 - (n)))
+#define CHACHA20_ROTL256(v, n) _mm256_or_si256(_mm256_slli_epi32(v, n), _mm256_srli_epi32(v, 32 - (n)))
+
+/* SSE2 kernel, four blocks of lanes j..j+3 */
+CHACHA20_TARGET("sse2")
+static void chacha20_ks4(unsigned char *ks, const uint32_t st[16], const chacha20_lanes ln, unsigned j)
+{
+	__m128i x[16], s[16];
+	int i;
+
+	for (i = 0; i < 12; i++)
+		s[i] = _mm_set1_epi32((int)st[i]);
+	for (i = 0; i < 4; i++)
+		s[12 + i] = _mm_loadu_si128((const __m128i*)&ln[i][j]);
+
+	for (i = 0; i < 16; i++)
+		x[i] = s[i];
+
+	CHACHA20_VROUNDS(_mm_add_epi32, _mm_xor_si128, CHACHA20_ROTL128, x);
+
+	for (i = 0; i < 16; i += 4)
+	{
+		__m128i a = _mm_add_epi32(x[i + 0], s[i + 0]);
+		__m128i b = _mm_add_epi32(x[i + 1], s[i + 1]);
+		__m128i c = _mm_add_epi32(x[i + 2], s[i + 2]);
+		__m128i d = _mm_add_epi32(x[i + 3], s[i + 3]);
+
+		__m128i t0 = _mm_unpacklo_epi32(a, b);
+		__m128i t1 = _mm_unpacklo_epi32(c, d);
+		__m128i t2 = _mm_unpackhi_epi32(a, b);
+		__m128i t3 = _mm_unpackhi_epi32(c, d);
+
+		_mm_storeu_si128((__m128i*)(ks + 0 * 64 + i * 4), _mm_unpacklo_epi64(t0, t1));
+		_mm_storeu_si128((__m128i*)(ks + 1 * 64 + i * 4), _mm_unpackhi_epi64(t0, t1));
+		_mm_storeu_si128((__m128i*)(ks + 2 * 64 + i * 4), _mm_unpacklo_epi64(t2, t3));
+		_mm_storeu_si128((__m128i*)(ks + 3 * 64 + i * 4), _mm_unpackhi_epi64(t2, t3));
+	}
+}
+
+/* AVX2 kernel, eight blocks, 128-bit halves hold blocks 0-3 and 4-7 */
+CHACHA20_TARGET("avx2")
+static void chacha20_ks8(unsigned char *ks, const uint32_t st[16], const chacha20_lanes ln)
+{
+	__m256i x[16], s[16];
+	int i;
+
+	for (i = 0; i < 12; i++)
+		s[i] = _mm256_set1_epi32((int)st[i]);
+	for (i = 0; i < 4; i++)
+		s[12 + i] = _mm256_loadu_si256((const __m256i*)ln[i]);
+
+	for (i = 0; i < 16; i++)
+		x[i] = s[i];
+
+	CHACHA20_VROUNDS(_mm256_add_epi32, _mm256_xor_si256, CHACHA20_ROTL256, x);
+
+	for (i = 0; i < 16; i += 4)
+	{
+		__m256i a = _mm256_add_epi32(x[i + 0], s[i + 0]);
+		__m256i b = _mm256_add_epi32(x[i + 1], s[i + 1]);
+		__m256i c = _mm256_add_epi32(x[i + 2], s[i + 2]);
+		__m256i d = _mm256_add_epi32(x[i + 3], s[i + 3]);
+
+		__m256i t0 = _mm256_unpacklo_epi32(a, b);
+		__m256i t1 = _mm256_unpacklo_epi32(c, d);
+		__m256i t2 = _mm256_unpackhi_epi32(a, b);
+		__m256i t3 = _mm256_unpackhi_epi32(c, d);
+
+		__m256i r0 = _mm256_unpacklo_epi64(t0, t1);
+		__m256i r1 = _mm256_unpackhi_epi64(t0, t1);
+		__m256i r2 = _mm256_unpacklo_epi64(t2, t3);
+		__m256i r3 = _mm256_unpackhi_epi64(t2, t3);
+
+		_mm_storeu_si128((__m128i*)(ks + 0 * 64 + i * 4), _mm256_castsi256_si128(r0));
+		_mm_storeu_si128((__m128i*)(ks + 1 * 64 + i * 4), _mm256_castsi256_si128(r1));
+		_mm_storeu_si128((__m128i*)(ks + 2 * 64 + i * 4), _mm256_castsi256_si128(r2));
+		_mm_storeu_si128((__m128i*)(ks + 3 * 64 + i * 4), _mm256_castsi256_si128(r3));
+		_mm_storeu_si128((__m128i*)(ks + 4 * 64 + i * 4), _mm256_extracti128_si256(r0, 1));
+		_mm_storeu_si128((__m128i*)(ks + 5 * 64 + i * 4), _mm256_extracti128_si256(r1, 1));
+		_mm_storeu_si128((__m128i*)(ks + 6 * 64 + i * 4), _mm256_extracti128_si256(r2, 1));
+		_mm_storeu_si128((__m128i*)(ks + 7 * 64 + i * 4), _mm256_extracti128_si256(r3, 1));
+	}
+}
+
+/* 2 - AVX2, 1 - SSE2, 0 - portable */
+static int chacha20_cpu(void)
+{
+#if defined(__GNUC__)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		return 2;
+	if (__builtin_cpu_supports("sse2"))
+		return 1;
+#else
+	int r[4];
+	__cpuid(r, 0);
+	if (r[0] >= 7)
+	{
+		__cpuid(r, 1);
+		/* OS must save YMM state */
+		if ((r[2] & (1 << 27)) && (_xgetbv(0) & 6) == 6)
+		{
+			__cpuidex(r, 7, 0);
+			if (r[1] & (1 << 5))
+				return 2;
+		}
+	}
+	__cpuid(r, 1);
+	if (r[3] & (1 << 26))
+		return 1;
+#endif
+	return 0;
+}
+
+#endif /* CHACHA20_X86 */
+
+const char* chacha20_impl(void)
+{
+	static const char* const name[] = { "portable", "sse2", "avx2" };
+#ifdef CHACHA20_X86
+	return name[chacha20_cpu()];
+#else
+	return name[0];
+#endif
+}
+
+/* generate keystream of lanes 0..n-1, n <= CHACHA20_BATCH */
+static void chacha20_lanes_ks(unsigned char *ks, const uint32_t st[16], const chacha20_lanes ln, unsigned n)
+{
+	unsigned j = 0;
+
+#ifdef CHACHA20_X86
+	static volatile int cpu = -1;	/* detected once, concurrent detection is harmless */
+
+	if (cpu < 0)
+		cpu = chacha20_cpu();
+
+	if (cpu == 2 && n > 4)
+	{
+		chacha20_ks8(ks, st, ln);
+		return;
+	}
+
+	if (cpu >= 1)
+	{
+		for (; j + 1 < n; j += 4)
+			chacha20_ks4(ks + j * 64, st, ln, j);
+	}
+#endif
+
+	for (; j < n; j++)
+		chacha20_ks1(ks + j * 64, st, ln, j);
+}
+
+/* generate n <= CHACHA20_BATCH blocks of keystream, starting with block ctr */
+static void chacha20_ks(unsigned char *ks, const uint32_t st[16], uint32_t ctr, unsigned n)
+{
+	chacha20_lanes ln;
+	unsigned j;
+
+	for (j = 0; j < CHACHA20_BATCH; j++)
+	{
+		ln[0][j] = ctr + j;
+		ln[1][j] = st[13];
+		ln[2][j] = st[14];
+		ln[3][j] = st[15];
+	}
+
+	chacha20_lanes_ks(ks, st, ln, n);
+}
+
+static void chacha20_xor_bytes(unsigned char *out, const unsigned char *in, const unsigned char *ks, size_t len)
+{
+	size_t i = 0;
+
+	for (; i + 8 <= len; i += 8)
+	{
+		uint64_t a, b;
+		memcpy(&a, in + i, 8);
+		memcpy(&b, ks + i, 8);
+		a ^= b;
+		memcpy(out + i, &a, 8);
+	}
+
+	for (; i < len; i++)
+		out[i] = in[i] ^ ks[i];
+}
+
+static void chacha20_setup(uint32_t st[16], const unsigned char key[32], const unsigned char nonce[12])
+{
+	int i;
+
+	st[0] = 0x61707865;	/* "expand 32-byte k" */
+	st[1] = 0x3320646e;
+	st[2] = 0x79622d32;
+	st[3] = 0x6b206574;
+	for (i = 0; i < 8; i++)
+		st[4 + i] = CHACHA20_LOAD32(key + 4 * i);
+	st[12] = 0;
+	st[13] = CHACHA20_LOAD32(nonce + 0);
+	st[14] = CHACHA20_LOAD32(nonce + 4);
+	st[15] = CHACHA20_LOAD32(nonce + 8);
+}
+
+void chacha20_keystream(unsigned char *ks, size_t blocks, const unsigned char key[32], const unsigned char nonce[12])
+{
+	unsigned char tmp[CHACHA20_BATCH * 64];
+	uint32_t st[16];
+	uint32_t ctr = 0;
+
+	chacha20_setup(st, key, nonce);
+
+	while (blocks > 0)
+	{
+		unsigned n = blocks > CHACHA20_BATCH ? CHACHA20_BATCH : (unsigned)blocks;
+
+		/* vector kernels may fill more than n blocks */
+		if (n < CHACHA20_BATCH)
+		{
+			chacha20_ks(tmp, st, ctr, n);
+			memcpy(ks, tmp, n * 64);
+		}
+		else
+			chacha20_ks(ks, st, ctr, n);
+
+		ks += n * 64;
+		ctr += n;
+		blocks -= n;
+	}
+}
+
+void chacha20_aead(unsigned char *out, unsigned char otk[32], const unsigned char *in, size_t len,
+	const unsigned char key[32], const unsigned char nonce[12])
+{
+	unsigned char ks[CHACHA20_BATCH * 64];
+	uint32_t st[16];
+	uint32_t ctr = 0;
+	size_t off = 64;	/* message starts at block 1 */
+
+	chacha20_setup(st, key, nonce);
+
+	do
+	{
+		/* number of blocks still needed, including block 0 on first pass */
+		size_t need = (off + len + 63) / 64;
+		unsigned n = need > CHACHA20_BATCH ? CHACHA20_BATCH : (unsigned)need;
+		size_t l = n * 64 - off;
+
+		chacha20_ks(ks, st, ctr, n);
+
+		if (ctr == 0)
+			memcpy(otk, ks, 32);
+
+		if (l > len)
+			l = len;
+		chacha20_xor_bytes(out, in, ks + off, l);
+
+		out += l;
+		in += l;
+		len -= l;
+		ctr += n;
+		off = 0;
+	} while (len > 0);
+}
+
+void chacha20_aead_frames(unsigned char *const out[], unsigned char (*otk)[32], const unsigned char *const in[],
+	const size_t len[], size_t count, const unsigned char key[32], const unsigned char nonce[12])
+{
+	unsigned char ks[CHACHA20_BATCH * 64];
+	chacha20_lanes ln;
+	struct
+	{
+		size_t msg;
+		uint32_t blk;
+	} job[CHACHA20_BATCH];
+	uint32_t st[16];
+	uint64_t seq = CHACHA20_LOAD64(nonce + 4);
+	size_t m = 0;	/* next block to schedule is block b of message m */
+	uint32_t b = 0;
+	unsigned n, j;
+
+	chacha20_setup(st, key, nonce);
+	memset(ln, 0, sizeof(ln));
+
+	while (m < count)
+	{
+		/* lanes take the next blocks regardless of message boundaries */
+		for (n = 0; n < CHACHA20_BATCH && m < count; n++)
+		{
+			uint64_t s = seq + m;
+
+			ln[0][n] = b;
+			ln[1][n] = st[13];
+			ln[2][n] = (uint32_t)s;
+			ln[3][n] = (uint32_t)(s >> 32);
+			job[n].msg = m;
+			job[n].blk = b;
+
+			if ((size_t)b * 64 >= len[m])
+			{
+				m++;
+				b = 0;
+			}
+			else
+				b++;
+		}
+
+		chacha20_lanes_ks(ks, st, ln, n);
+
+		for (j = 0; j < n; j++)
+		{
+			size_t i = job[j].msg;
+
+			if (job[j].blk == 0)
+				memcpy(otk[i], ks + j * 64, 32);
+			else
+			{
+				size_t off = (size_t)(job[j].blk - 1) * 64;
+				size_t l = len[i] - off;
+
+				if (l > 64)
+					l = 64;
+				chacha20_xor_bytes(out[i] + off, in[i] + off, ks + j * 64, l);
+			}
+		}
+	}
+}
@@ -0,0 +1,533 @@
+#include "ed25519_fe.h"
+
+/*
+    64-bit field arithmetic, radix 2^51
+    An element t, entries t[0]...t[4], represents the integer
+    t[0]+2^51 t[1]+2^102 t[2]+2^153 t[3]+2^204 t[4].
+    Results of all operations are carried, so limbs stay below 2^51 + 2^13,
+    products are accumulated in 128-bit integers.
+*/
+
+typedef unsigned __int128 fe_uint128;
+
+#define FE_MASK51 ((uint64_t)0x7ffffffffffff)
+
+/* load_3 and load_4 are also used by ed25519_sc.c */
+static uint64_t load_3(const unsigned char *in) {
+    uint64_t result;
+
+    result = (uint64_t) in[0];
+    result |= ((uint64_t) in[1]) << 8;
+    result |= ((uint64_t) in[2]) << 16;
+
+    return result;
+}
+
+static uint64_t load_4(const unsigned char *in) {
+    uint64_t result;
+
+    result = (uint64_t) in[0];
+    result |= ((uint64_t) in[1]) << 8;
+    result |= ((uint64_t) in[2]) << 16;
+    result |= ((uint64_t) in[3]) << 24;
+
+    return result;
+}
+
+static uint64_t load_8(const unsigned char *in) {
+    uint64_t result = 0;
+    int i;
+
+    for (i = 7; i >= 0; i--) {
+        result = (result << 8) | in[i];
+    }
+
+    return result;
+}
+
+static void store_8(unsigned char *out, uint64_t v) {
+    int i;
+
+    for (i = 0; i < 8; i++) {
+        out[i] = (unsigned char)(v >> (8 * i));
+    }
+}
+
+/* carry all limbs once, top carry is multiplied by 19 */
+static void fe_carry(fe h) {
+    uint64_t c;
+
+    c = h[0] >> 51; h[0] &= FE_MASK51; h[1] += c;
+    c = h[1] >> 51; h[1] &= FE_MASK51; h[2] += c;
+    c = h[2] >> 51; h[2] &= FE_MASK51; h[3] += c;
+    c = h[3] >> 51; h[3] &= FE_MASK51; h[4] += c;
+    c = h[4] >> 51; h[4] &= FE_MASK51; h[0] += c * 19;
+}
+
+/* reduce 128-bit limb products */
+static void fe_reduce128(fe h, fe_uint128 r0, fe_uint128 r1, fe_uint128 r2, fe_uint128 r3, fe_uint128 r4) {
+    uint64_t c;
+
+    r1 += (uint64_t)(r0 >> 51); h[0] = (uint64_t)r0 & FE_MASK51;
+    r2 += (uint64_t)(r1 >> 51); h[1] = (uint64_t)r1 & FE_MASK51;
+    r3 += (uint64_t)(r2 >> 51); h[2] = (uint64_t)r2 & FE_MASK51;
+    r4 += (uint64_t)(r3 >> 51); h[3] = (uint64_t)r3 & FE_MASK51;
+    c = (uint64_t)(r4 >> 51); h[4] = (uint64_t)r4 & FE_MASK51;
+    h[0] += c * 19;
+    c = h[0] >> 51; h[0] &= FE_MASK51; h[1] += c;
+}
+
+
+
+/*
+    h = 0
+*/
+
+void fe_0(fe h) {
+    h[0] = 0;
+    h[1] = 0;
+    h[2] = 0;
+    h[3] = 0;
+    h[4] = 0;
+}
+
+
+
+/*
+    h = 1
+*/
+
+void fe_1(fe h) {
+    h[0] = 1;
+    h[1] = 0;
+    h[2] = 0;
+    h[3] = 0;
+    h[4] = 0;
+}
+
+
+
+/*
+    h = f + g
+*/
+
+void fe_add(fe h, const fe f, const fe g) {
+    h[0] = f[0] + g[0];
+    h[1] = f[1] + g[1];
+    h[2] = f[2] + g[2];
+    h[3] = f[3] + g[3];
+    h[4] = f[4] + g[4];
+    fe_carry(h);
+}
+
+
+
+/*
+    h = f - g
+    2*p is added to keep limbs positive
+*/
+
+void fe_sub(fe h, const fe f, const fe g) {
+    h[0] = f[0] + 0xfffffffffffdaULL - g[0];
+    h[1] = f[1] + 0xffffffffffffeULL - g[1];
+    h[2] = f[2] + 0xffffffffffffeULL - g[2];
+    h[3] = f[3] + 0xffffffffffffeULL - g[3];
+    h[4] = f[4] + 0xffffffffffffeULL - g[4];
+    fe_carry(h);
+}
+
+
+
+/*
+    h = -f
+*/
+
+void fe_neg(fe h, const fe f) {
+    fe zero;
+
+    fe_0(zero);
+    fe_sub(h, zero, f);
+}
+
+
+
+/*
+    Replace (f,g) with (g,g) if b == 1;
+    replace (f,g) with (f,g) if b == 0.
+
+    Preconditions: b in {0,1}.
+*/
+
+void fe_cmov(fe f, const fe g, unsigned int b) {
+    uint64_t mask = (uint64_t)0 - b;
+
+    f[0] ^= mask & (f[0] ^ g[0]);
+    f[1] ^= mask & (f[1] ^ g[1]);
+    f[2] ^= mask & (f[2] ^ g[2]);
+    f[3] ^= mask & (f[3] ^ g[3]);
+    f[4] ^= mask & (f[4] ^ g[4]);
+}
+
+
+
+/*
+    Replace (f,g) with (g,f) if b == 1;
+    replace (f,g) with (f,g) if b == 0.
+
+    Preconditions: b in {0,1}.
+*/
+
+void fe_cswap(fe f, fe g, unsigned int b) {
+    uint64_t mask = (uint64_t)0 - b;
+    uint64_t x;
+    int i;
+
+    for (i = 0; i < 5; i++) {
+        x = mask & (f[i] ^ g[i]);
+        f[i] ^= x;
+        g[i] ^= x;
+    }
+}
+
+
+
+/*
+    h = f
+*/
+
+void fe_copy(fe h, const fe f) {
+    h[0] = f[0];
+    h[1] = f[1];
+    h[2] = f[2];
+    h[3] = f[3];
+    h[4] = f[4];
+}
+
+
+
+/*
+    Ignores top bit of s.
+*/
+
+void fe_frombytes(fe h, const unsigned char *s) {
+    h[0] = load_8(s) & FE_MASK51;
+    h[1] = (load_8(s + 6) >> 3) & FE_MASK51;
+    h[2] = (load_8(s + 12) >> 6) & FE_MASK51;
+    h[3] = (load_8(s + 19) >> 1) & FE_MASK51;
+    h[4] = (load_8(s + 24) >> 12) & FE_MASK51;
+}
+
+
+
+/*
+    Stores fully reduced h in s.
+*/
+
+void fe_tobytes(unsigned char *s, const fe h) {
+    uint64_t t[5];
+    uint64_t q;
+
+    fe_copy(t, h);
+    fe_carry(t);
+    fe_carry(t);
+
+    /* q = 1 if t >= p */
+    q = (t[0] + 19) >> 51;
+    q = (t[1] + q) >> 51;
+    q = (t[2] + q) >> 51;
+    q = (t[3] + q) >> 51;
+    q = (t[4] + q) >> 51;
+
+    /* t - q*p, as t + 19*q - q*2^255 */
+    t[0] += 19 * q;
+    t[1] += t[0] >> 51; t[0] &= FE_MASK51;
+    t[2] += t[1] >> 51; t[1] &= FE_MASK51;
+    t[3] += t[2] >> 51; t[2] &= FE_MASK51;
+    t[4] += t[3] >> 51; t[3] &= FE_MASK51;
+    t[4] &= FE_MASK51;
+
+    store_8(s + 0, t[0] | (t[1] << 51));
+    store_8(s + 8, (t[1] >> 13) | (t[2] << 38));
+    store_8(s + 16, (t[2] >> 26) | (t[3] << 25));
+    store_8(s + 24, (t[3] >> 39) | (t[4] << 12));
+}
+
+
+
+/*
+    return 1 if f is in {1,3,5,...,q-2}
+    return 0 if f is in {0,2,4,...,q-1}
+*/
+
+int fe_isnegative(const fe f) {
+    unsigned char s[32];
+
+    fe_tobytes(s, f);
+
+    return s[0] & 1;
+}
+
+
+
+/*
+    return 1 if f == 0
+    return 0 if f != 0
+*/
+
+int fe_isnonzero(const fe f) {
+    unsigned char s[32];
+    unsigned char r = 0;
+    int i;
+
+    fe_tobytes(s, f);
+
+    for (i = 0; i < 32; i++) {
+        r |= s[i];
+    }
+
+    return r != 0;
+}
+
+
+
+/*
+    h = f * g
+*/
+
+void fe_mul(fe h, const fe f, const fe g) {
+    uint64_t f0 = f[0], f1 = f[1], f2 = f[2], f3 = f[3], f4 = f[4];
+    uint64_t g0 = g[0], g1 = g[1], g2 = g[2], g3 = g[3], g4 = g[4];
+    uint64_t g1_19 = 19 * g1, g2_19 = 19 * g2, g3_19 = 19 * g3, g4_19 = 19 * g4;
+    fe_uint128 r0, r1, r2, r3, r4;
+
+    r0 = (fe_uint128)f0 * g0 + (fe_uint128)f1 * g4_19 + (fe_uint128)f2 * g3_19 + (fe_uint128)f3 * g2_19 + (fe_uint128)f4 * g1_19;
+    r1 = (fe_uint128)f0 * g1 + (fe_uint128)f1 * g0 + (fe_uint128)f2 * g4_19 + (fe_uint128)f3 * g3_19 + (fe_uint128)f4 * g2_19;
+    r2 = (fe_uint128)f0 * g2 + (fe_uint128)f1 * g1 + (fe_uint128)f2 * g0 + (fe_uint128)f3 * g4_19 + (fe_uint128)f4 * g3_19;
+    r3 = (fe_uint128)f0 * g3 + (fe_uint128)f1 * g2 + (fe_uint128)f2 * g1 + (fe_uint128)f3 * g0 + (fe_uint128)f4 * g4_19;
+    r4 = (fe_uint128)f0 * g4 + (fe_uint128)f1 * g3 + (fe_uint128)f2 * g2 + (fe_uint128)f3 * g1 + (fe_uint128)f4 * g0;
+
+    fe_reduce128(h, r0, r1, r2, r3, r4);
+}
+
+
+
+/*
+    h = f * 121666
+*/
+
+void fe_mul121666(fe h, fe f) {
+    fe_uint128 r0 = (fe_uint128)f[0] * 121666;
+    fe_uint128 r1 = (fe_uint128)f[1] * 121666;
+    fe_uint128 r2 = (fe_uint128)f[2] * 121666;
+    fe_uint128 r3 = (fe_uint128)f[3] * 121666;
+    fe_uint128 r4 = (fe_uint128)f[4] * 121666;
+
+    fe_reduce128(h, r0, r1, r2, r3, r4);
+}
+
+
+
+/*
+    h = f * f
+*/
+
+void fe_sq(fe h, const fe f) {
+    uint64_t f0 = f[0], f1 = f[1], f2 = f[2], f3 = f[3], f4 = f[4];
+    uint64_t f0_2 = 2 * f0, f1_2 = 2 * f1;
+    uint64_t f3_19 = 19 * f3, f4_19 = 19 * f4;
+    fe_uint128 r0, r1, r2, r3, r4;
+
+    r0 = (fe_uint128)f0 * f0 + (fe_uint128)(2 * f1) * f4_19 + (fe_uint128)(2 * f2) * f3_19;
+    r1 = (fe_uint128)f0_2 * f1 + (fe_uint128)(2 * f2) * f4_19 + (fe_uint128)f3 * f3_19;
+    r2 = (fe_uint128)f0_2 * f2 + (fe_uint128)f1 * f1 + (fe_uint128)(2 * f3) * f4_19;
+    r3 = (fe_uint128)f0_2 * f3 + (fe_uint128)f1_2 * f2 + (fe_uint128)f4 * f4_19;
+    r4 = (fe_uint128)f0_2 * f4 + (fe_uint128)f1_2 * f3 + (fe_uint128)f2 * f2;
+
+    fe_reduce128(h, r0, r1, r2, r3, r4);
+}
+
+
+
+/*
+    h = 2 * f * f
+*/
+
+void fe_sq2(fe h, const fe f) {
+    fe_sq(h, f);
+    fe_add(h, h, h);
+}
+
+
+
+void fe_invert(fe out, const fe z) {
+    fe t0;
+    fe t1;
+    fe t2;
+    fe t3;
+    int i;
+
+    fe_sq(t0, z);
+
+    for (i = 1; i < 1; ++i) {
+        fe_sq(t0, t0);
+    }
+
+    fe_sq(t1, t0);
+
+    for (i = 1; i < 2; ++i) {
+        fe_sq(t1, t1);
+    }
+
+    fe_mul(t1, z, t1);
+    fe_mul(t0, t0, t1);
+    fe_sq(t2, t0);
+
+    for (i = 1; i < 1; ++i) {
+        fe_sq(t2, t2);
+    }
+
+    fe_mul(t1, t1, t2);
+    fe_sq(t2, t1);
+
+    for (i = 1; i < 5; ++i) {
+        fe_sq(t2, t2);
+    }
+
+    fe_mul(t1, t2, t1);
+    fe_sq(t2, t1);
+
+    for (i = 1; i < 10; ++i) {
+        fe_sq(t2, t2);
+    }
+
+    fe_mul(t2, t2, t1);
+    fe_sq(t3, t2);
+
+    for (i = 1; i < 20; ++i) {
+        fe_sq(t3, t3);
+    }
+
+    fe_mul(t2, t3, t2);
+    fe_sq(t2, t2);
+
+    for (i = 1; i < 10; ++i) {
+        fe_sq(t2, t2);
+    }
+
+    fe_mul(t1, t2, t1);
+    fe_sq(t2, t1);
+
+    for (i = 1; i < 50; ++i) {
+        fe_sq(t2, t2);
+    }
+
+    fe_mul(t2, t2, t1);
+    fe_sq(t3, t2);
+
+    for (i = 1; i < 100; ++i) {
+        fe_sq(t3, t3);
+    }
+
+    fe_mul(t2, t3, t2);
+    fe_sq(t2, t2);
+
+    for (i = 1; i < 50; ++i) {
+        fe_sq(t2, t2);
+    }
+
+    fe_mul(t1, t2, t1);
+    fe_sq(t1, t1);
+
+    for (i = 1; i < 5; ++i) {
+        fe_sq(t1, t1);
+    }
+
+    fe_mul(out, t1, t0);
+}
+
+
+
+void fe_pow22523(fe out, const fe z) {
+    fe t0;
+    fe t1;
+    fe t2;
+    int i;
+    fe_sq(t0, z);
+
+    for (i = 1; i < 1; ++i) {
+        fe_sq(t0, t0);
+    }
+
+    fe_sq(t1, t0);
+
+    for (i = 1; i < 2; ++i) {
+        fe_sq(t1, t1);
+    }
+
+    fe_mul(t1, z, t1);
+    fe_mul(t0, t0, t1);
+    fe_sq(t0, t0);
+
+    for (i = 1; i < 1; ++i) {
+        fe_sq(t0, t0);
+    }
+
+    fe_mul(t0, t1, t0);
+    fe_sq(t1, t0);
+
+    for (i = 1; i < 5; ++i) {
+        fe_sq(t1, t1);
+    }
+
+    fe_mul(t0, t1, t0);
+    fe_sq(t1, t0);
+
+    for (i = 1; i < 10; ++i) {
+        fe_sq(t1, t1);
+    }
+
+    fe_mul(t1, t1, t0);
+    fe_sq(t2, t1);
+
+    for (i = 1; i < 20; ++i) {
+        fe_sq(t2, t2);
+    }
+
+    fe_mul(t1, t2, t1);
+    fe_sq(t1, t1);
+
+    for (i = 1; i < 10; ++i) {
+        fe_sq(t1, t1);
+    }
+
+    fe_mul(t0, t1, t0);
+    fe_sq(t1, t0);
+
+    for (i = 1; i < 50; ++i) {
+        fe_sq(t1, t1);
+    }
+
+    fe_mul(t1, t1, t0);
+    fe_sq(t2, t1);
+
+    for (i = 1; i < 100; ++i) {
+        fe_sq(t2, t2);
+    }
+
+    fe_mul(t1, t2, t1);
+    fe_sq(t1, t1);
+
+    for (i = 1; i < 50; ++i) {
+        fe_sq(t1, t1);
+    }
+
+    fe_mul(t0, t1, t0);
+    fe_sq(t0, t0);
+
+    for (i = 1; i < 2; ++i) {
+        fe_sq(t0, t0);
+    }
+
+    fe_mul(out, t0, z);
+    return;
+}
@@ -40,12 +40,12 @@ enum jsmnerr {
  * end		end position in JSON data string
  */
 typedef struct {
-	int16_t start;
-	int16_t end;
+	int32_t start;
+	int32_t end;
 	int8_t type;
-	int8_t size;
+	int16_t size;		// wide enough for config files with hundreds of pairing records
 #ifdef JSMN_PARENT_LINKS
-	int8_t parent;
+	int16_t parent;
 #endif
 } jsmntok_t;
 
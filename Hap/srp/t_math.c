@@ -1053,9 +1053,261 @@ BigIntegerModMul(BigInteger r, BigInteger m1, BigInteger m2, BigInteger modulus,
 	return BIG_INTEGER_SUCCESS;
 }
 
+/*
+ * Fixed-base exponentiation
+ *
+ * SRP raises the same generator to a new secret exponent modulo the same
+ * group on every pair-setup (B = kv + g^b). For a single digit base the
+ * powers g^(2^(FB_COMB*k)), k < FB_TEETH, and all their products are
+ * precomputed once in Montgomery form (Lim-Lee comb), so an exponent of up
+ * to FB_BITS bits costs FB_COMB squarings and multiplications instead of
+ * a squaring per exponent bit plus window multiplications.
+ * Montgomery arithmetic uses 64-bit words and 128-bit products, other
+ * bases, moduli and longer exponents go to mp_exptmod.
+ * The table is built on first use and published atomically, it is never
+ * changed or freed afterwards, so concurrent callers need no lock. Only the
+ * first base and modulus (the SRP group) get the table, others go to
+ * mp_exptmod.
+ */
+#if defined(__SIZEOF_INT128__)
+
+#define FB_TEETH 6		/* 64 table entries, 24KB for 3072-bit modulus */
+#define FB_BITS 256		/* max exponent size, SRP secret size */
+#define FB_COMB ((FB_BITS + FB_TEETH - 1) / FB_TEETH)
+#define FB_WORDS 64		/* max modulus size, 4096 bits */
+
+typedef unsigned __int128 fb_uint128;
+
+struct fb_table
+{
+	int n;					/* modulus size in 64-bit words */
+	uint64_t m[FB_WORDS];	/* modulus */
+	uint64_t m0;			/* -1/m mod 2^64 */
+	mp_digit g;				/* base */
+	uint64_t * t;			/* 1 << FB_TEETH entries of n words, t[0] = R mod m */
+};
+
+static struct fb_table * fb;	/* set once by fb_exptmod, read-only then */
+
+/* x to n little endian 64-bit words, x must fit */
+static void
+fb_from_mp(uint64_t * w, int n, const mp_int * x)
+{
+	unsigned char b[FB_WORDS * 8];
+	int len = mp_unsigned_bin_size(x);
+	int i;
+
+	memset(b, 0, n * 8 - len);
+	mp_to_unsigned_bin(x, b + n * 8 - len);
+
+	for(i = 0; i < n; ++i) {
+		const unsigned char * p = b + (n - 1 - i) * 8;
+		w[i] = ((uint64_t)p[0] << 56) | ((uint64_t)p[1] << 48) | ((uint64_t)p[2] << 40) | ((uint64_t)p[3] << 32) |
+			((uint64_t)p[4] << 24) | ((uint64_t)p[5] << 16) | ((uint64_t)p[6] << 8) | (uint64_t)p[7];
+	}
+}
+
+static void
+fb_to_mp(mp_int * x, const uint64_t * w, int n)
+{
+	unsigned char b[FB_WORDS * 8];
+	int i, j;
+
+	for(i = 0; i < n; ++i)
+		for(j = 0; j < 8; ++j)
+			b[(n - 1 - i) * 8 + j] = (unsigned char)(w[i] >> (56 - 8 * j));
+
+	mp_read_unsigned_bin(x, b, n * 8);
+}
+
+/* r = a * b / R mod m, CIOS */
+static void
+fb_mont_mul(const struct fb_table * f, uint64_t * r, const uint64_t * a, const uint64_t * b)
+{
+	uint64_t t[FB_WORDS + 2];
+	uint64_t d[FB_WORDS];
+	uint64_t u, borrow;
+	fb_uint128 c;
+	int n = f->n;
+	int i, j;
+
+	memset(t, 0, (n + 2) * sizeof(uint64_t));
+
+	for(i = 0; i < n; ++i) {
+		/* t += a * b[i] */
+		c = 0;
+		for(j = 0; j < n; ++j) {
+			c += (fb_uint128)a[j] * b[i] + t[j];
+			t[j] = (uint64_t)c;
+			c >>= 64;
+		}
+		c += t[n];
+		t[n] = (uint64_t)c;
+		t[n + 1] = (uint64_t)(c >> 64);
+
+		/* t = (t + u * m) / 2^64 */
+		u = t[0] * f->m0;
+		c = ((fb_uint128)u * f->m[0] + t[0]) >> 64;
+		for(j = 1; j < n; ++j) {
+			c += (fb_uint128)u * f->m[j] + t[j];
+			t[j - 1] = (uint64_t)c;
+			c >>= 64;
+		}
+		c += t[n];
+		t[n - 1] = (uint64_t)c;
+		t[n] = t[n + 1] + (uint64_t)(c >> 64);
+	}
+
+	/* t < 2m, subtract m once if t >= m */
+	borrow = 0;
+	for(j = 0; j < n; ++j) {
+		c = (fb_uint128)t[j] - f->m[j] - borrow;
+		d[j] = (uint64_t)c;
+		borrow = (uint64_t)(c >> 64) & 1;
+	}
+
+	if(t[n] != 0 || borrow == 0)
+		memcpy(r, d, n * sizeof(uint64_t));
+	else
+		memcpy(r, t, n * sizeof(uint64_t));
+}
+
+/* build comb table of g modulo m, returns NULL if not applicable */
+static struct fb_table *
+fb_init(mp_digit g, const mp_int * m)
+{
+	struct fb_table * f;
+	mp_int x, rm;
+	uint64_t inv;
+	int n = (mp_count_bits(m) + 63) / 64;
+	int i, k;
+
+	if(n > FB_WORDS || mp_iseven(m))
+		return NULL;
+
+	f = (struct fb_table *)malloc(sizeof(struct fb_table) + (1 << FB_TEETH) * n * sizeof(uint64_t));
+	if(f == NULL)
+		return NULL;
+
+	f->t = (uint64_t *)(f + 1);
+	f->n = n;
+	fb_from_mp(f->m, n, m);
+	f->g = g;
+
+	/* -1/m mod 2^64, Newton iteration */
+	inv = f->m[0];
+	for(i = 0; i < 5; ++i)
+		inv *= 2 - f->m[0] * inv;
+	f->m0 = (uint64_t)0 - inv;
+
+	mp_init(&x);
+	mp_init(&rm);
+
+	/* t[0] = R mod m */
+	mp_2expt(&rm, n * 64);
+	mp_mod(&rm, m, &rm);
+	fb_from_mp(f->t, n, &rm);
+
+	/* t[1 << k] = g^(2^(FB_COMB*k)) * R mod m */
+	mp_set(&x, g);
+	for(k = 0; k < FB_TEETH; ++k) {
+		mp_int y;
+		mp_init(&y);
+		mp_mulmod(&x, &rm, m, &y);
+		fb_from_mp(f->t + ((size_t)1 << k) * n, n, &y);
+		mp_clear(&y);
+		for(i = 0; i < FB_COMB; ++i)
+			mp_sqrmod(&x, m, &x);
+	}
+
+	mp_clear(&x);
+	mp_clear(&rm);
+
+	/* other entries are products of the single bit ones */
+	for(i = 3; i < (1 << FB_TEETH); ++i)
+		if(i & (i - 1))
+			fb_mont_mul(f, f->t + i * n, f->t + (i & (i - 1)) * n, f->t + (i & -i) * n);
+
+	return f;
+}
+
+/* r = b^e mod m using the comb table, returns 0 if not applicable */
+static int
+fb_exptmod(mp_int * r, const mp_int * b, const mp_int * e, const mp_int * m)
+{
+	uint64_t w[FB_WORDS];
+	uint64_t ew[(FB_BITS + 63) / 64 + 1];
+	uint64_t acc[FB_WORDS];
+	struct fb_table * f;
+	int n, i, k;
+
+	if(b->used != 1 || b->sign != MP_ZPOS || mp_cmp_d(b, 1) != MP_GT)
+		return 0;
+	if(e->sign != MP_ZPOS || mp_count_bits(e) > FB_BITS)
+		return 0;
+
+	n = (mp_count_bits(m) + 63) / 64;
+	if(n > FB_WORDS)
+		return 0;
+
+	/* first caller builds the table, when two race the loser's table is dropped */
+	f = __atomic_load_n(&fb, __ATOMIC_ACQUIRE);
+	if(f == NULL) {
+		struct fb_table * expected = NULL;
+
+		f = fb_init(b->dp[0], m);
+		if(f == NULL)
+			return 0;
+
+		if(!__atomic_compare_exchange_n(&fb, &expected, f, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+			free(f);
+			f = expected;
+		}
+	}
+
+	/* the table serves one base and modulus */
+	fb_from_mp(w, n, m);
+	if(f->n != n || f->g != b->dp[0] || memcmp(w, f->m, n * sizeof(uint64_t)) != 0)
+		return 0;
+
+	memset(ew, 0, sizeof(ew));
+	fb_from_mp(ew, (FB_BITS + 63) / 64, e);
+
+	memcpy(acc, f->t, n * sizeof(uint64_t));
+	for(i = FB_COMB - 1; i >= 0; --i) {
+		int idx = 0;
+
+		fb_mont_mul(f, acc, acc, acc);
+
+		for(k = 0; k < FB_TEETH; ++k) {
+			int bit = k * FB_COMB + i;
+			if(bit < FB_BITS)
+				idx |= (int)((ew[bit >> 6] >> (bit & 63)) & 1) << k;
+		}
+
+		if(idx != 0)
+			fb_mont_mul(f, acc, acc, f->t + idx * n);
+	}
+
+	/* out of Montgomery form */
+	memset(w, 0, n * sizeof(uint64_t));
+	w[0] = 1;
+	fb_mont_mul(f, acc, acc, w);
+
+	fb_to_mp(r, acc, n);
+
+	return 1;
+}
+
+#endif
+
 BigIntegerResult
 BigIntegerModExp(BigInteger r, BigInteger b, BigInteger e, BigInteger m, BigIntegerCtx c, BigIntegerModAccel a)
 {
+#if defined(__SIZEOF_INT128__)
+	if(fb_exptmod(r, b, e, m))
+		return BIG_INTEGER_SUCCESS;
+#endif
 	mp_exptmod(b, e, m, r);
 	return BIG_INTEGER_SUCCESS;
 }
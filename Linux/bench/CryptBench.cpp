@@ -0,0 +1,342 @@
+/*
+MIT License
+
+Copyright (c) 2018 Gera Kazakov
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+// Crypto benchmark
+//	measures Hap::Crypt primitives and the SRP modular exponentiations,
+//	reports ops/sec and cycles per call and per byte.
+//	Each primitive runs for at least the given time (ms, default 200).
+//	Cycles come from the CPU cycle counter (perf events) when permitted,
+//	otherwise from TSC on x86, otherwise cycle columns are not shown
+
+#include "HapCrypt.cpp"
+#include "HapSrp.cpp"
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <chrono>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+extern "C" {
+	void t_stronginitrand()
+	{
+	}
+
+	void t_random(unsigned char* data, unsigned size)
+	{
+		Hap::Crypt::Random::Fill(data, size);
+	}
+}
+
+namespace Hap
+{
+	void Log(const char* f, ...) {}
+}
+
+class Signer : public Hap::Crypt::Ed25519
+{
+public:
+	Signer() { init(); }
+};
+
+// cycle counter
+class Cycles
+{
+public:
+	Cycles()
+	{
+		perf_event_attr attr;
+		memset(&attr, 0, sizeof(attr));
+		attr.type = PERF_TYPE_HARDWARE;
+		attr.size = sizeof(attr);
+		attr.config = PERF_COUNT_HW_CPU_CYCLES;
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+
+		_fd = (int)syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+		if (_fd >= 0)
+		{
+			ioctl(_fd, PERF_EVENT_IOC_ENABLE, 0);
+
+			// counter may be present but not counting (VMs)
+			uint64_t c = now();
+			for (volatile int i = 0; i < 100000; i++);
+			if (now() == c)
+			{
+				close(_fd);
+				_fd = -1;
+			}
+		}
+	}
+
+	~Cycles()
+	{
+		if (_fd >= 0)
+			close(_fd);
+	}
+
+	const char* Source() const
+	{
+		if (_fd >= 0)
+			return "CPU cycles";
+#if defined(__x86_64__) || defined(__i386__)
+		return "TSC ticks";
+#else
+		return nullptr;
+#endif
+	}
+
+	uint64_t now()
+	{
+		if (_fd >= 0)
+		{
+			uint64_t c = 0;
+			if (read(_fd, &c, sizeof(c)) != sizeof(c))
+				return 0;
+			return c;
+		}
+#if defined(__x86_64__) || defined(__i386__)
+		return __rdtsc();
+#else
+		return 0;
+#endif
+	}
+
+private:
+	int _fd = -1;
+};
+
+static Cycles cycles;
+static double minTime;		// seconds per primitive
+
+struct Result
+{
+	double us;				// microseconds per call
+	double cycles;			// cycles per call
+};
+
+// run fn in growing batches until minTime passes, return cost of one call
+template<typename F> static Result bench(F fn)
+{
+	fn();	// warm up caches and lazy tables
+
+	uint64_t n = 0;
+	uint64_t batch = 1;
+	double elapsed = 0;
+	uint64_t c0 = cycles.now();
+	auto start = std::chrono::steady_clock::now();
+
+	while (elapsed < minTime)
+	{
+		for (uint64_t i = 0; i < batch; i++)
+			fn();
+		n += batch;
+
+		elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		if (elapsed < minTime / 16)
+			batch *= 2;
+	}
+
+	uint64_t c1 = cycles.now();
+
+	return Result{ elapsed * 1e6 / n, double(c1 - c0) / n };
+}
+
+static void header()
+{
+	printf("%-26s %6s %12s %10s", "", "bytes", "ops/s", "us/op");
+	if (cycles.Source() != nullptr)
+		printf(" %12s %8s", "cycles/op", "c/byte");
+	printf("\n");
+}
+
+// size 0 - not a bulk operation, no per byte column
+static void report(const char* name, size_t size, const Result& r)
+{
+	if (size)
+		printf("%-26s %6zu %12.0f %10.2f", name, size, 1e6 / r.us, r.us);
+	else
+		printf("%-26s %6s %12.0f %10.2f", name, "-", 1e6 / r.us, r.us);
+
+	if (cycles.Source() != nullptr)
+	{
+		if (size)
+			printf(" %12.0f %8.2f", r.cycles, r.cycles / size);
+		else
+			printf(" %12.0f %8s", r.cycles, "-");
+	}
+	printf("\n");
+}
+
+int main(int argc, char* argv[])
+{
+	unsigned ms = argc > 1 ? atoi(argv[1]) : 200;
+	minTime = (ms ? ms : 200) / 1000.;
+
+	constexpr size_t MaxSize = 16 * 1024;
+	static const size_t sizes[] = { 64, 1024, MaxSize };
+	static uint8_t in[MaxSize];
+	static uint8_t out[MaxSize + MaxSize / 1024 * (Hap::Crypt::FrameHdr + Hap::Crypt::TagSize)];
+
+	uint8_t key[32];
+	uint8_t nonce[12] = {};
+	uint8_t tag[Hap::Crypt::TagSize];
+	uint8_t digest[SHA512_DIGEST_SIZE];
+	uint8_t okm[32];
+
+	t_random(in, sizeof(in));
+	t_random(key, sizeof(key));
+
+#if defined(ED25519_FE64)
+	printf("field arithmetic: 64-bit\n");
+#else
+	printf("field arithmetic: 32-bit\n");
+#endif
+	printf("chacha20 kernel: %s\n", chacha20_impl());
+	if (cycles.Source() != nullptr)
+		printf("cycles: %s\n", cycles.Source());
+	printf("\n");
+
+	header();
+
+	// symmetric primitives
+	for (size_t size : sizes)
+		report("aead seal", size, bench([&]() { Hap::Crypt::aead(Hap::Crypt::Encrypt, out, tag, key, nonce, in, (uint16_t)size); }));
+
+	// HAP framing of a large response, 1024 bytes per frame
+	report("aead seal frames", MaxSize, bench([&]() { Hap::Crypt::aead_seal_frames(out, key, 0, in, MaxSize, 1024); }));
+
+	for (size_t size : sizes)
+		report("chacha20 keystream", size, bench([&]() { chacha20_keystream(out, size / 64, key, nonce); }));
+
+	for (size_t size : sizes)
+		report("poly1305", size, bench([&]() {
+			poly1305_context ctx;
+			poly1305_init(&ctx, key);
+			poly1305_update(&ctx, in, size);
+			poly1305_finish(&ctx, tag);
+		}));
+
+	for (size_t size : sizes)
+		report("sha512", size, bench([&]() { sha512(in, (unsigned)size, digest); }));
+
+	for (size_t size : sizes)
+		report("hmac_sha512", size, bench([&]() { hmac_sha512(key, sizeof(key), in, (unsigned)size, digest, sizeof(digest)); }));
+
+	// key derivation as in pair-verify, 32 bytes of shared secret
+	report("hkdf", 0, bench([&]() {
+		Hap::Crypt::hkdf((const uint8_t*)"Pair-Verify-Encrypt-Salt", 24, key, sizeof(key),
+			(const uint8_t*)"Pair-Verify-Encrypt-Info", 24, okm, sizeof(okm));
+	}));
+
+	Hap::Crypt::Hkdf::Salt salt("Control-Salt");
+	report("Hkdf extract + 2 expand", 0, bench([&]() {
+		Hap::Crypt::Hkdf hkdf(salt, key, sizeof(key));
+		hkdf.expand("Control-Read-Encryption-Key", okm, sizeof(okm));
+		hkdf.expand("Control-Write-Encryption-Key", okm, sizeof(okm));
+	}));
+
+	// public key primitives
+	uint8_t prv[Hap::Crypt::Curve25519::KeySize];
+	uint8_t pub[Hap::Crypt::Curve25519::KeySize];
+	uint8_t sign[Hap::Crypt::Ed25519::SignSize];
+	uint8_t msg[100];
+
+	Hap::Crypt::Curve25519 curve;
+	Hap::Crypt::Curve25519 peer;
+	Signer signer;
+
+	t_random(msg, sizeof(msg));
+	curve.Init();
+	peer.Init();
+	memcpy(key, peer.getPublicKey(), sizeof(key));
+	signer.Sign(sign, msg, sizeof(msg));
+
+	Result keypair = bench([&]() { Hap::Crypt::Curve25519::Generate(prv, pub); });
+	// each secret is the next peer key so the calls can't be folded
+	Result shared = bench([&]() { memcpy(key, curve.getSharedSecret(key), sizeof(key)); });
+	Result signing = bench([&]() { signer.Sign(sign, msg, sizeof(msg)); });
+	Result verify = bench([&]() { signer.Verify(sign, msg, sizeof(msg), signer.PubKey()); });
+
+	report("Curve25519 key pair", 0, keypair);
+	report("Curve25519 shared key", 0, shared);
+	report("Ed25519 sign", 0, signing);
+	report("Ed25519 verify", 0, verify);
+
+	// SRP-3072 modexps of pair-setup, operand sizes as in srp6_server.c
+	uint8_t bytes[SHA512_DIGEST_SIZE];
+	BigInteger N = BigIntegerFromBytes(srp_modulus, sizeof_srp_modulus);
+	BigInteger g = BigIntegerFromBytes(srp_generator, sizeof_srp_generator);
+	BigInteger r = BigIntegerFromInt(0);
+
+	t_random(bytes, SHA512_DIGEST_SIZE);
+	BigInteger x = BigIntegerFromBytes(bytes, SHA512_DIGEST_SIZE);	// password hash
+	t_random(bytes, SHA512_DIGEST_SIZE);
+	BigInteger u = BigIntegerFromBytes(bytes, SHA512_DIGEST_SIZE);	// H(A | B)
+	t_random(bytes, 32);
+	BigInteger b = BigIntegerFromBytes(bytes, 32);					// server secret
+	t_random(bytes, 32);
+	BigInteger a = BigIntegerFromBytes(bytes, 32);					// client secret
+
+	BigInteger v = BigIntegerFromInt(0);
+	BigInteger A = BigIntegerFromInt(0);
+	BigInteger t = BigIntegerFromInt(0);
+	BigInteger Avu = BigIntegerFromInt(0);
+	BigIntegerModExp(v, g, x, N, NULL, NULL);
+	BigIntegerModExp(A, g, a, N, NULL, NULL);
+	BigIntegerModExp(t, v, u, N, NULL, NULL);
+	BigIntegerModMul(Avu, A, t, N, NULL);
+
+	Result verifier = bench([&]() { BigIntegerModExp(r, g, x, N, NULL, NULL); });
+	Result pubkey = bench([&]() { BigIntegerModExp(r, g, b, N, NULL, NULL); });
+	Result vu = bench([&]() { BigIntegerModExp(r, v, u, N, NULL, NULL); });
+	Result premaster = bench([&]() { BigIntegerModExp(r, Avu, b, N, NULL, NULL); });
+
+	report("SRP verifier g^x", 0, verifier);
+	report("SRP public key g^b", 0, pubkey);
+	report("SRP v^u", 0, vu);
+	report("SRP premaster (Av^u)^b", 0, premaster);
+
+	BigIntegerFree(N);
+	BigIntegerFree(g);
+	BigIntegerFree(r);
+	BigIntegerClearFree(x);
+	BigIntegerFree(u);
+	BigIntegerClearFree(b);
+	BigIntegerClearFree(a);
+	BigIntegerFree(v);
+	BigIntegerFree(A);
+	BigIntegerFree(t);
+	BigIntegerFree(Avu);
+
+	printf("\n");
+	printf("pair-verify handshake   %10.1f us\n", keypair.us + shared.us + signing.us + verify.us);
+	printf("pair-setup modexps      %10.1f us\n", pubkey.us + vu.us + premaster.us);
+
+	return 0;
+}
@@ -0,0 +1,863 @@
+/*
+MIT License
+
+Copyright (c) 2018 Gera Kazakov
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+// HAP load generator, end-to-end benchmark against local HapLinux
+//	pairs with the server once, the controller keys are kept in keys file for following runs.
+//	Then each of N sessions connects, runs pair-verify, optionally subscribes to events
+//	of the characteristic and sends request mix of GET /accessories, GET /characteristics
+//	and PUT /characteristics, as fast as possible or at given rate.
+//	Reports throughput and latency percentiles per request type
+
+#define SRP_TEST					// HapSrp.cpp compiles SRP client
+#include "HapCrypt.cpp"
+#include "HapSrp.cpp"
+#include "picohttpparser.cpp"
+
+#include "CLI11.hpp"
+
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+extern "C" {
+	void t_stronginitrand()
+	{
+	}
+
+	void t_random(unsigned char* data, unsigned size)
+	{
+		Hap::Crypt::Random::Fill(data, size);
+	}
+}
+
+namespace Hap
+{
+	bool debug = false;
+	void Log(const char* f, ...) {}
+	void Hex(const char* Header, const void* Buffer, size_t Length) {}
+}
+
+using Clock = std::chrono::steady_clock;
+
+// request types, latency is collected per type
+enum Op : uint8_t
+{
+	OpVerify,
+	OpAccessories,
+	OpRead,
+	OpWrite,
+	OpCount
+};
+
+static const char* opName[] =
+{
+	"pair-verify",
+	"GET /accessories",
+	"GET /characteristics",
+	"PUT /characteristics",
+};
+
+static struct
+{
+	Hap::Metrics::Histogram hist[OpCount];
+	std::atomic<uint64_t> errors;
+	std::atomic<uint64_t> events;
+} stats;
+
+// controller identity, created by pair-setup
+class Controller : public Hap::Crypt::Ed25519
+{
+public:
+	constexpr static uint8_t IdLen = 36;
+
+	char id[IdLen + 1];
+
+	void Create()
+	{
+		uint8_t r[16];
+		t_random(r, sizeof(r));
+
+		snprintf(id, sizeof(id), "%02X%02X%02X%02X-%02X%02X-%02X%02X-%02X%02X-%02X%02X%02X%02X%02X%02X",
+			r[0], r[1], r[2], r[3], r[4], r[5], r[6], r[7], r[8], r[9], r[10], r[11], r[12], r[13], r[14], r[15]);
+
+		init();
+	}
+
+	bool Load(const char* file)
+	{
+		uint8_t pub[PubKeySize];
+		uint8_t prv[PrvKeySize];
+
+		FILE* f = fopen(file, "rb");
+		if (f == NULL)
+			return false;
+
+		bool ok = fread(id, 1, IdLen, f) == IdLen
+			&& fread(pub, 1, sizeof(pub), f) == sizeof(pub)
+			&& fread(prv, 1, sizeof(prv), f) == sizeof(prv);
+
+		fclose(f);
+
+		if (!ok)
+			return false;
+
+		id[IdLen] = 0;
+		init(pub, prv);
+		return true;
+	}
+
+	bool Save(const char* file)
+	{
+		FILE* f = fopen(file, "wb");
+		if (f == NULL)
+			return false;
+
+		bool ok = fwrite(id, 1, IdLen, f) == IdLen
+			&& fwrite(_pubKey, 1, sizeof(_pubKey), f) == sizeof(_pubKey)
+			&& fwrite(_prvKey, 1, sizeof(_prvKey), f) == sizeof(_prvKey);
+
+		fclose(f);
+		return ok;
+	}
+};
+
+// HTTP connection to the accessory, secured after pair-verify
+class Connection
+{
+public:
+	unsigned events = 0;		// event notifications received
+	unsigned split = 0;			// send data in pieces of this size, 0 - at once
+
+	~Connection()
+	{
+		Close();
+	}
+
+	bool Open(const char* host, uint16_t port)
+	{
+		Close();
+
+		_sd = socket(AF_INET, SOCK_STREAM, 0);
+		if (_sd < 0)
+			return false;
+
+		int one = 1;
+		setsockopt(_sd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+		// do not wait forever for lost response
+		timeval tv = { 5, 0 };
+		setsockopt(_sd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+		sockaddr_in sa = {};
+		sa.sin_family = AF_INET;
+		sa.sin_port = htons(port);
+		inet_pton(AF_INET, host, &sa.sin_addr);
+
+		return connect(_sd, (sockaddr*)&sa, sizeof(sa)) == 0;
+	}
+
+	void Close()
+	{
+		if (_sd >= 0)
+			close(_sd);
+
+		_sd = -1;
+		_secured = false;
+		_readSeq = _writeSeq = 0;
+		_raw.clear();
+		_in.clear();
+		_out.clear();
+	}
+
+	// derive session keys from pair-verify shared secret
+	void Secure(const uint8_t* secret)
+	{
+		Hap::Crypt::Hkdf hkdf("Control-Salt", secret, 32);
+		hkdf.expand("Control-Read-Encryption-Key", _readKey, sizeof(_readKey));
+		hkdf.expand("Control-Write-Encryption-Key", _writeKey, sizeof(_writeKey));
+
+		_secured = true;
+	}
+
+	// send request and wait for its response
+	//	returns HTTP status or -1 on error
+	int Request(const char* method, const char* path, const char* type, const void* body, size_t len, std::string& rsp)
+	{
+		Queue(method, path, type, body, len);
+
+		if (!Flush())
+			return -1;
+
+		return Response(rsp);
+	}
+
+	// add request to the output, queued requests are sent back to back by Flush
+	void Queue(const char* method, const char* path, const char* type, const void* body, size_t len)
+	{
+		char hdr[256];
+		int l;
+
+		if (type != nullptr)
+			l = snprintf(hdr, sizeof(hdr), "%s %s HTTP/1.1\r\nContent-Type: %s\r\nContent-Length: %d\r\n\r\n",
+				method, path, type, (int)len);
+		else
+			l = snprintf(hdr, sizeof(hdr), "%s %s HTTP/1.1\r\n\r\n", method, path);
+
+		_out.append(hdr, l);
+		if (body != nullptr)
+			_out.append((const char*)body, len);
+	}
+
+	bool Flush()
+	{
+		bool ok = _send(_out);
+		_out.clear();
+		return ok;
+	}
+
+	// wait for next response, events received meanwhile are counted
+	//	returns HTTP status or -1 on error
+	int Response(std::string& rsp)
+	{
+		while (true)
+		{
+			bool event;
+			int status = _message(rsp, event);
+
+			if (status < 0)
+				return -1;
+
+			if (status == 0)	// incomplete
+			{
+				if (!_recv())
+					return -1;
+				continue;
+			}
+
+			if (!event)
+				return status;
+
+			events++;
+		}
+	}
+
+private:
+	int _sd = -1;
+	bool _secured = false;
+	uint8_t _readKey[32];
+	uint8_t _writeKey[32];
+	uint64_t _readSeq = 0;
+	uint64_t _writeSeq = 0;
+	std::string _raw;			// received frames, not decrypted yet
+	std::string _in;			// received HTTP data
+	std::string _out;			// queued requests
+
+	bool _send(const std::string& data)
+	{
+		const uint8_t* p = (const uint8_t*)data.data();
+		size_t len = data.size();
+		std::vector<uint8_t> frames;
+
+		if (_secured)
+		{
+			size_t count = (len + Hap::MaxHttpBlock - 1) / Hap::MaxHttpBlock;
+
+			frames.resize(len + count * (2 + 16));
+			Hap::Crypt::aead_seal_frames(frames.data(), _writeKey, _writeSeq, p, len, Hap::MaxHttpBlock);
+			_writeSeq += count;
+
+			p = frames.data();
+			len = frames.size();
+		}
+
+		while (len > 0)
+		{
+			size_t n = len;
+			if (split && n > split)
+			{
+				// let each piece go out as own segment
+				n = split;
+				std::this_thread::sleep_for(std::chrono::microseconds(200));
+			}
+
+			ssize_t l = send(_sd, p, n, MSG_NOSIGNAL);
+			if (l <= 0)
+				return false;
+
+			p += l;
+			len -= l;
+		}
+
+		return true;
+	}
+
+	// receive more data, decrypt complete frames
+	bool _recv()
+	{
+		char b[4096];
+
+		ssize_t l = recv(_sd, b, sizeof(b), 0);
+		if (l <= 0)
+			return false;
+
+		if (!_secured)
+		{
+			_in.append(b, l);
+			return true;
+		}
+
+		_raw.append(b, l);
+
+		while (_raw.size() >= 2)
+		{
+			const uint8_t* f = (const uint8_t*)_raw.data();
+			uint16_t aad = f[0] | (f[1] << 8);
+
+			if (_raw.size() < 2u + aad + 16)
+				break;
+
+			uint8_t d[Hap::MaxHttpBlock];
+			if (aad > sizeof(d) || Hap::Crypt::aead_open_frames(d, _readKey, _readSeq, f, 1) < 0)
+				return false;
+
+			_readSeq++;
+			_in.append((const char*)d, aad);
+			_raw.erase(0, 2 + aad + 16);
+		}
+
+		return true;
+	}
+
+	// extract one response or event from received data
+	//	returns HTTP status, 0 if message is not complete yet, -1 on error
+	int _message(std::string& body, bool& event)
+	{
+		if (_in.empty())
+			return 0;
+
+		// event has HTTP response format with own protocol name
+		std::string msg = _in;
+		size_t shift = 0;
+
+		event = msg.compare(0, 10, "EVENT/1.0 ") == 0;
+		if (event)
+		{
+			msg.replace(0, 9, "HTTP/1.0");
+			shift = 1;
+		}
+
+		int minor, status;
+		const char* m;
+		size_t ml;
+		Hap::Http::phr_header hdr[Hap::MaxHttpHeaders];
+		size_t hdr_count = sizeofarr(hdr);
+
+		int rc = Hap::Http::phr_parse_response(msg.data(), msg.size(), &minor, &status, &m, &ml, hdr, &hdr_count, 0);
+		if (rc == -2)
+			return 0;
+		if (rc < 0)
+			return -1;
+
+		size_t length = 0;
+		bool chunked = false;
+
+		for (size_t i = 0; i < hdr_count; i++)
+		{
+			std::string name(hdr[i].name, hdr[i].name_len);
+
+			if (strcasecmp(name.c_str(), "Content-Length") == 0)
+				length = atoi(std::string(hdr[i].value, hdr[i].value_len).c_str());
+			else if (strcasecmp(name.c_str(), "Transfer-Encoding") == 0)
+				chunked = true;
+		}
+
+		if (chunked)
+		{
+			// decoded in place, so a copy is decoded until the body is complete
+			Hap::Http::phr_chunked_decoder dec = {};
+			dec.consume_trailer = 1;
+			std::string b = msg.substr(rc);
+			size_t size = b.size();
+
+			ssize_t left = Hap::Http::phr_decode_chunked(&dec, &b[0], &size);
+			if (left == -2)
+				return 0;
+			if (left < 0)
+				return -1;
+
+			body.assign(b, 0, size);
+			_in.erase(0, _in.size() - left);
+			return status;
+		}
+
+		if (msg.size() < rc + length)
+			return 0;
+
+		body.assign(_in, rc + shift, length);
+		_in.erase(0, rc + shift + length);
+		return status;
+	}
+};
+
+static const char* ContentTypeTlv = "application/pairing+tlv8";
+static const char* ContentTypeJson = "application/hap+json";
+
+// send TLV request, parse response TLV into rsp buffer
+static bool tlvRequest(Connection& c, const char* path, const uint8_t* req, uint16_t len, std::string& rsp, Hap::Tlv::Parse<Hap::MaxHttpTlv>& tlv)
+{
+	int status = c.Request("POST", path, ContentTypeTlv, req, len, rsp);
+	if (status != 200)
+		return false;
+
+	tlv.parse((const uint8_t*)rsp.data(), rsp.size());
+
+	uint8_t err;
+	return !tlv.get(Hap::Tlv::Type::Error, err);
+}
+
+static bool pairSetup(Connection& c, Controller& ctl, const char* setupCode)
+{
+	using namespace Hap::Tlv;
+
+	uint8_t b[1024];
+	Create req;
+	Parse<Hap::MaxHttpTlv> tlv;
+	std::string rsp;
+	bool ok = false;
+
+	// M1 -> M2: salt and accessory SRP public key
+	req.create(b, sizeof(b));
+	req.add(Type::State, State::M1);
+	req.add(Type::Method, Method::PairSetupNonMfi);
+
+	if (!tlvRequest(c, "/pair-setup", b, req.length(), rsp, tlv))
+		return false;
+
+	uint8_t salt[16];
+	uint8_t pubB[512];
+	uint16_t salt_len = sizeof(salt);
+	uint16_t pubB_len = sizeof(pubB);
+
+	if (!tlv.get(Type::Salt, salt, salt_len) || !tlv.get(Type::PublicKey, pubB, pubB_len))
+		return false;
+
+	SRP* srp = SRP_new(SRP6a_client_method());
+	cstr* pubA = NULL;
+	cstr* key = NULL;
+	cstr* proof = NULL;
+
+	SRP_set_username(srp, "Pair-Setup");
+	SRP_set_params(srp, srp_modulus, sizeof_srp_modulus, srp_generator, sizeof_srp_generator, salt, salt_len);
+	SRP_gen_pub(srp, &pubA);
+	SRP_set_auth_password(srp, setupCode);
+
+	if (SRP_compute_key(srp, &key, pubB, pubB_len) != SRP_SUCCESS || SRP_respond(srp, &proof) != SRP_SUCCESS)
+		goto Ret;
+
+	// M3 -> M4: controller public key and proof, accessory proof
+	req.create(b, sizeof(b));
+	req.add(Type::State, State::M3);
+	req.add(Type::PublicKey, (const uint8_t*)pubA->data, pubA->length);
+	req.add(Type::Proof, (const uint8_t*)proof->data, proof->length);
+
+	if (!tlvRequest(c, "/pair-setup", b, req.length(), rsp, tlv))
+		goto Ret;
+
+	{
+		Item srvProof;
+		if (!tlv.get(Type::Proof, srvProof) || SRP_verify(srp, srvProof.val(), srvProof.len()) != SRP_SUCCESS)
+			goto Ret;
+	}
+
+	// M5 -> M6: exchange long-term public keys
+	{
+		uint8_t sessKey[32];
+		uint8_t x[32];
+		Hap::Crypt::Hkdf("Pair-Setup-Encrypt-Salt", (const uint8_t*)key->data, key->length)
+			.expand("Pair-Setup-Encrypt-Info", sessKey, sizeof(sessKey));
+		Hap::Crypt::Hkdf("Pair-Setup-Controller-Sign-Salt", (const uint8_t*)key->data, key->length)
+			.expand("Pair-Setup-Controller-Sign-Info", x, sizeof(x));
+
+		uint8_t info[32 + Controller::IdLen + Controller::PubKeySize];
+		memcpy(info, x, 32);
+		memcpy(info + 32, ctl.id, Controller::IdLen);
+		memcpy(info + 32 + Controller::IdLen, ctl.PubKey(), Controller::PubKeySize);
+
+		uint8_t sign[Controller::SignSize];
+		ctl.Sign(sign, info, sizeof(info));
+
+		uint8_t sub[256];
+		Create subTlv;
+		subTlv.create(sub, sizeof(sub) - 16);
+		subTlv.add(Type::Identifier, (const uint8_t*)ctl.id, Controller::IdLen);
+		subTlv.add(Type::PublicKey, ctl.PubKey(), Controller::PubKeySize);
+		subTlv.add(Type::Signature, sign, sizeof(sign));
+
+		uint16_t l = subTlv.length();
+		Hap::Crypt::aead(Hap::Crypt::Encrypt, sub, sub + l, sessKey, (const uint8_t*)"\0\0\0\0PS-Msg05", sub, l);
+
+		req.create(b, sizeof(b));
+		req.add(Type::State, State::M5);
+		req.add(Type::EncryptedData, sub, l + 16);
+
+		ok = tlvRequest(c, "/pair-setup", b, req.length(), rsp, tlv);
+	}
+
+Ret:
+	cstr_free(pubA);
+	cstr_free(key);
+	cstr_free(proof);
+	SRP_free(srp);
+	return ok;
+}
+
+static bool pairVerify(Connection& c, Controller& ctl)
+{
+	using namespace Hap::Tlv;
+
+	uint8_t b[512];
+	Create req;
+	Parse<Hap::MaxHttpTlv> tlv;
+	std::string rsp;
+
+	Hap::Crypt::Curve25519 curve;
+	curve.Init();
+
+	// M1 -> M2: exchange ephemeral keys, accessory proof
+	req.create(b, sizeof(b));
+	req.add(Type::State, State::M1);
+	req.add(Type::PublicKey, curve.getPublicKey(), Hap::Crypt::Curve25519::KeySize);
+
+	if (!tlvRequest(c, "/pair-verify", b, req.length(), rsp, tlv))
+		return false;
+
+	Item srvKey;
+	uint8_t enc[256];
+	uint16_t enc_len = sizeof(enc);
+
+	if (!tlv.get(Type::PublicKey, srvKey) || srvKey.len() != Hap::Crypt::Curve25519::KeySize
+		|| !tlv.get(Type::EncryptedData, enc, enc_len) || enc_len < 16)
+		return false;
+
+	uint8_t srvPub[Hap::Crypt::Curve25519::KeySize];
+	memcpy(srvPub, srvKey.val(), sizeof(srvPub));
+
+	const uint8_t* secret = curve.getSharedSecret(srvPub);
+
+	uint8_t sessKey[32];
+	Hap::Crypt::Hkdf("Pair-Verify-Encrypt-Salt", secret, 32).expand("Pair-Verify-Encrypt-Info", sessKey, sizeof(sessKey));
+
+	// tag is calculated over the ciphertext, so it is not decrypted in place
+	uint8_t dec[sizeof(enc)];
+	uint8_t tag[16];
+	Hap::Crypt::aead(Hap::Crypt::Decrypt, dec, tag, sessKey, (const uint8_t*)"\0\0\0\0PV-Msg02", enc, enc_len - 16);
+	if (memcmp(tag, enc + enc_len - 16, 16) != 0)
+		return false;
+
+	// M3 -> M4: controller proof
+	uint8_t info[Hap::Crypt::Curve25519::KeySize * 2 + Controller::IdLen];
+	memcpy(info, curve.getPublicKey(), Hap::Crypt::Curve25519::KeySize);
+	memcpy(info + Hap::Crypt::Curve25519::KeySize, ctl.id, Controller::IdLen);
+	memcpy(info + Hap::Crypt::Curve25519::KeySize + Controller::IdLen, srvPub, Hap::Crypt::Curve25519::KeySize);
+
+	uint8_t sign[Controller::SignSize];
+	ctl.Sign(sign, info, sizeof(info));
+
+	uint8_t sub[160];
+	Create subTlv;
+	subTlv.create(sub, sizeof(sub) - 16);
+	subTlv.add(Type::Identifier, (const uint8_t*)ctl.id, Controller::IdLen);
+	subTlv.add(Type::Signature, sign, sizeof(sign));
+
+	uint16_t l = subTlv.length();
+	Hap::Crypt::aead(Hap::Crypt::Encrypt, sub, sub + l, sessKey, (const uint8_t*)"\0\0\0\0PV-Msg03", sub, l);
+
+	req.create(b, sizeof(b));
+	req.add(Type::State, State::M3);
+	req.add(Type::EncryptedData, sub, l + 16);
+
+	if (!tlvRequest(c, "/pair-verify", b, req.length(), rsp, tlv))
+		return false;
+
+	c.Secure(secret);
+	return true;
+}
+
+constexpr static unsigned MaxPipeline = 32;
+
+struct Options
+{
+	std::string host = "127.0.0.1";
+	uint16_t port = 7889;
+	std::string setupCode = "000-11-000";
+	std::string keys = "HapLoad.keys";
+	unsigned sessions = 4;
+	unsigned duration = 10;			// seconds
+	unsigned rate = 0;				// requests per second per session, 0 - closed loop
+	unsigned reverify = 0;			// reconnect after this many requests, 0 - never
+	unsigned pipeline = 1;			// requests sent back to back before reading responses
+	unsigned split = 0;				// send requests in pieces of this size, 0 - at once
+	bool events = false;			// subscribe to characteristic events
+	unsigned acc = 1;				// request mix per cycle
+	unsigned get = 4;
+	unsigned put = 2;
+	unsigned aid = 1;				// characteristic to read/write, integer format
+	unsigned iid = 10;
+};
+
+static void session(unsigned n, const Options& opt, Controller& ctl, Clock::time_point end)
+{
+	Connection c;
+	std::string rsp;
+	char path[64];
+	char json[128];
+
+	// request mix
+	std::vector<Op> mix;
+	mix.insert(mix.end(), opt.acc, OpAccessories);
+	mix.insert(mix.end(), opt.get, OpRead);
+	mix.insert(mix.end(), opt.put, OpWrite);
+
+	auto interval = std::chrono::microseconds(opt.rate ? 1000000 / opt.rate : 0);
+	auto next = Clock::now();
+	unsigned k = n;		// sessions start at different point of the mix
+
+	while (Clock::now() < end)
+	{
+		auto t0 = Clock::now();
+
+		if (!c.Open(opt.host.c_str(), opt.port) || !pairVerify(c, ctl))
+		{
+			stats.errors++;
+			std::this_thread::sleep_for(std::chrono::milliseconds(100));
+			continue;
+		}
+
+		stats.hist[OpVerify].Add(std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - t0).count());
+
+		if (opt.events)
+		{
+			int l = snprintf(json, sizeof(json), "{\"characteristics\":[{\"aid\":%u,\"iid\":%u,\"ev\":true}]}", opt.aid, opt.iid);
+			if (c.Request("PUT", "/characteristics", ContentTypeJson, json, l, rsp) != 204)
+				stats.errors++;
+		}
+
+		c.split = opt.split;
+
+		for (unsigned r = 0; (opt.reverify == 0 || r < opt.reverify) && !mix.empty(); r += opt.pipeline)
+		{
+			// latency is counted from the scheduled time, so server stalls are not hidden
+			//	by requests that were not sent meanwhile
+			if (opt.rate)
+			{
+				next += interval * opt.pipeline;
+				std::this_thread::sleep_until(next);
+				t0 = next;
+			}
+			else
+			{
+				t0 = Clock::now();
+			}
+
+			if (t0 >= end)
+				break;
+
+			// the batch is written at once, then the responses are read in order
+			Op ops[MaxPipeline];
+			for (unsigned i = 0; i < opt.pipeline; i++)
+			{
+				Op op = mix[k++ % mix.size()];
+				ops[i] = op;
+
+				switch (op)
+				{
+				case OpAccessories:
+					c.Queue("GET", "/accessories", nullptr, nullptr, 0);
+					break;
+
+				case OpRead:
+					snprintf(path, sizeof(path), "/characteristics?id=%u.%u", opt.aid, opt.iid);
+					c.Queue("GET", path, nullptr, nullptr, 0);
+					break;
+
+				case OpWrite:
+				{
+					int l = snprintf(json, sizeof(json), "{\"characteristics\":[{\"aid\":%u,\"iid\":%u,\"value\":%u}]}",
+						opt.aid, opt.iid, k % 100);
+					c.Queue("PUT", "/characteristics", ContentTypeJson, json, l);
+					break;
+				}
+
+				default:
+					break;
+				}
+			}
+
+			bool ok = c.Flush();
+
+			for (unsigned i = 0; ok && i < opt.pipeline; i++)
+			{
+				int expect = ops[i] == OpWrite ? 204 : 200;
+
+				if (c.Response(rsp) != expect)
+				{
+					ok = false;
+					break;
+				}
+
+				stats.hist[ops[i]].Add(std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - t0).count());
+			}
+
+			if (!ok)
+			{
+				stats.errors++;
+				break;
+			}
+		}
+
+		stats.events += c.events;
+		c.events = 0;
+		c.Close();
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	CLI::App app{ "HAP load generator, runs against local HapLinux" };
+	Options opt;
+	std::string chr = "1.10";
+
+	app.add_option("-H,--host", opt.host, "Server IPv4 address");
+	app.add_option("-p,--port", opt.port, "Server port");
+	app.add_option("-c,--code", opt.setupCode, "Setup code for pair-setup");
+	app.add_option("-k,--keys", opt.keys, "Controller keys file, created by pair-setup");
+	app.add_option("-s,--sessions", opt.sessions, "Concurrent sessions (server accepts up to 8)");
+	app.add_option("-d,--duration", opt.duration, "Test duration, seconds");
+	app.add_option("-r,--rate", opt.rate, "Requests per second per session, 0 - as fast as possible");
+	app.add_option("-v,--reverify", opt.reverify, "Reconnect and pair-verify after this many requests, 0 - never");
+	app.add_flag("-e,--events", opt.events, "Subscribe each session to the characteristic events");
+	app.add_option("-P,--pipeline", opt.pipeline, "Requests sent back to back before reading the responses")
+		->check(CLI::Range(1u, MaxPipeline));
+	app.add_option("--split", opt.split, "Send requests in pieces of this many bytes, splits frames across reads");
+	app.add_option("--acc", opt.acc, "GET /accessories per mix cycle");
+	app.add_option("--get", opt.get, "GET /characteristics per mix cycle");
+	app.add_option("--put", opt.put, "PUT /characteristics per mix cycle");
+	app.add_option("--char", chr, "Characteristic aid.iid to read and write, integer format");
+
+	CLI11_PARSE(app, argc, argv);
+
+	if (sscanf(chr.c_str(), "%u.%u", &opt.aid, &opt.iid) != 2)
+	{
+		printf("Invalid characteristic '%s'\n", chr.c_str());
+		return 1;
+	}
+
+	// pair once, following runs use saved keys
+	Controller ctl;
+	if (!ctl.Load(opt.keys.c_str()))
+	{
+		Connection c;
+		ctl.Create();
+
+		if (!c.Open(opt.host.c_str(), opt.port))
+		{
+			printf("Cannot connect to %s:%d\n", opt.host.c_str(), opt.port);
+			return 1;
+		}
+
+		if (!pairSetup(c, ctl, opt.setupCode.c_str()))
+		{
+			printf("Pair-setup failed, the server must be unpaired (HapLinux -R)\n");
+			return 1;
+		}
+
+		if (!ctl.Save(opt.keys.c_str()))
+			printf("Cannot save keys to %s\n", opt.keys.c_str());
+
+		printf("Paired as %s\n", ctl.id);
+	}
+
+	// check the pairing before starting the load
+	{
+		Connection c;
+		if (!c.Open(opt.host.c_str(), opt.port) || !pairVerify(c, ctl))
+		{
+			printf("Pair-verify failed, remove %s if the server was reset\n", opt.keys.c_str());
+			return 1;
+		}
+	}
+
+	printf("sessions %u  duration %u s  rate %u/s per session%s\n", opt.sessions, opt.duration, opt.rate,
+		opt.rate ? "" : " (as fast as possible)");
+	if (opt.pipeline > 1 || opt.split)
+		printf("pipeline %u  split %u\n", opt.pipeline, opt.split);
+
+	auto start = Clock::now();
+	auto end = start + std::chrono::seconds(opt.duration);
+
+	std::vector<std::thread> threads;
+	for (unsigned n = 0; n < opt.sessions; n++)
+		threads.emplace_back(session, n, std::cref(opt), std::ref(ctl), end);
+
+	for (auto& t : threads)
+		t.join();
+
+	double sec = std::chrono::duration<double>(Clock::now() - start).count();
+	uint64_t total = 0;
+
+	printf("%-22s %10s %10s %8s %8s %8s %8s  (us)\n", "", "count", "req/s", "p50", "p99", "p99.9", "max");
+
+	for (uint8_t op = 0; op < OpCount; op++)
+	{
+		const Hap::Metrics::Histogram& h = stats.hist[op];
+		uint64_t count = h.count.load();
+		uint64_t max = h.max.load();
+
+		if (count == 0)
+			continue;
+
+		if (op != OpVerify)
+			total += count;
+
+		// bucket bound may be above the largest value
+		auto pct = [&h, max](double p) -> unsigned long long {
+			uint64_t v = h.Percentile(p);
+			return v < max ? v : max;
+		};
+
+		printf("%-22s %10llu %10.0f %8llu %8llu %8llu %8llu\n", opName[op], (unsigned long long)count, count / sec,
+			pct(50), pct(99), pct(99.9), (unsigned long long)max);
+	}
+
+	printf("requests %llu  %.0f req/s  errors %llu  events %llu\n", (unsigned long long)total, total / sec,
+		(unsigned long long)stats.errors.load(), (unsigned long long)stats.events.load());
+
+	return 0;
+}
@@ -29,64 +29,70 @@ SOFTWARE.
 #include "jsmn.cpp"
 #include "picohttpparser.cpp"
 
-// HAP logging functions
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+
+// metrics in POSIX shared memory, /dev/shm/<name>
 namespace Hap
 {
-	void Hex(const char* Header, const void* Buffer, size_t Length)
+	namespace Metrics
 	{
-		static const char hex[] = "0123456789ABCDEF";
-		const uint8_t* a = (const uint8_t*)Buffer;
-		size_t i;
-		size_t max = 16;
-
-		Log("%s addr %p size 0x%X(%d):\n", Header, Buffer, (unsigned)Length, (unsigned)Length);
-
-		while (Length > 0)
+		bool Registry::Share(const char* name)
 		{
-			char line[52];
-			char *p = line;
-
-			if (Length < max)
-				max = Length;
-
-			memset(line, 0, sizeof(line));
-
-			for (i = 0; i < 16; i++)
+			int fd = shm_open(name, O_CREAT | O_RDWR, 0644);
+			if (fd < 0)
 			{
-				if (i < max)
-				{
-					*p++ = hex[(a[i] & 0xf0) >> 4];
-					*p++ = hex[a[i] & 0x0f];
-				}
-				else
-				{
-					*p++ = ' ';
-					*p++ = ' ';
-				}
+				Log("Metrics: shm_open(%s) error %s\n", name, strerror(errno));
+				return false;
 			}
 
-			*p++ = ' ';
-			*p++ = ' ';
-			*p++ = ' ';
+			void* p = MAP_FAILED;
+			if (ftruncate(fd, sizeof(Data)) == 0)
+				p = mmap(nullptr, sizeof(Data), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+			close(fd);
 
-			for (i = 0; i < max; i++)
+			if (p == MAP_FAILED)
 			{
-				if (a[i] < 0x20 || a[i] > 0x7e) *p++ = '.';
-				else *p++ = a[i];
+				Log("Metrics: cannot map %s, error %s\n", name, strerror(errno));
+				return false;
 			}
 
-			Log("0x%04lX:%s\n", (unsigned long)a & 0xFFFF, line);
+			// the block may be left by previous run, all of it is overwritten
+			Data* data = (Data*)p;
+			_copy(*data, *_data);
+			_data = data;
 
-			Length -= max;
-			a += max;
+			return true;
 		}
-	}
 
-	void Log(const char* f, ...)
-	{
-		va_list arg;
-		va_start(arg, f);
+		const Data* Registry::Open(const char* name)
+		{
+			int fd = shm_open(name, O_RDONLY, 0);
+			if (fd < 0)
+				return nullptr;
+
+			struct stat st;
+			void* p = MAP_FAILED;
+			if (fstat(fd, &st) == 0 && st.st_size >= (off_t)sizeof(Data))
+				p = mmap(nullptr, sizeof(Data), PROT_READ, MAP_SHARED, fd, 0);
+
+			close(fd);
+
+			if (p == MAP_FAILED)
+				return nullptr;
 
-		vprintf(f, arg);
+			const Data* data = (const Data*)p;
+			if (data->magic != Data::Magic || data->version != Data::Version || data->size != sizeof(Data))
+			{
+				munmap(p, sizeof(Data));
+				return nullptr;
+			}
+
+			return data;
+		}
 	}
 }
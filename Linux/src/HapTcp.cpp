@@ -24,6 +24,7 @@ SOFTWARE.
 
 #include "Hap.h"
 
+#include <atomic>
 #include <thread>
 #include <mutex>
 #include <condition_variable>
@@ -32,176 +33,453 @@ SOFTWARE.
 #include <fcntl.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
 
 namespace Hap
 {
+	// epoll-based TCP server
+	//	all sockets are registered in edge-triggered mode, epoll_event.data holds
+	//	the client slot index so readiness dispatch does not depend on number of clients;
+	//	events are signalled by Http::Server through an eventfd registered in the same epoll set,
+	//	so notifications are sent as soon as characteristic value changes
+	//	when worker threads are enabled, client sockets are also registered as one-shot,
+	//	the network thread queues ready slots to the workers, and the worker re-arms
+	//	the socket after the request is processed, so one session is never processed 
+	//	by two workers at the same time
+	//	busy slot is owned by its worker, other slots by the network thread, the owner 
+	//	processes, polls and re-arms the slot without holding mtx
+	//	sockets never block, output not accepted by the socket stays queued in Http::Server
+	//	and is sent by Process when the socket becomes writable (EPOLLOUT)
 	class TcpImpl : public Tcp
 	{
+	public:
+		static constexpr unsigned MaxWorkers = Hap::MaxHttpSessions;	// no use to have more workers than sessions
+
 	private:
+		static constexpr uint32_t MaxEvents = 16;			// max events returned by one epoll_wait
+		static constexpr uint32_t ServerSlot = 0xFFFFFFFF;	// epoll data of server socket
+		static constexpr uint32_t EventSlot = 0xFFFFFFFE;	// epoll data of event notification
+
 		std::thread task;
-		bool running = false;
+		std::atomic<bool> running{ false };	// cleared by Stop, read by the run loop and workers
 
 		int server;
+		int ep;			// epoll instance
+		int evfd;		// event notification, also used to wake up the run loop on Stop
 		int client[Hap::MaxHttpSessions + 1];
 		Hap::sid_t sess[Hap::MaxHttpSessions + 1];
+		bool busy[Hap::MaxHttpSessions + 1];		// slot is queued to or processed by a worker
+		bool again[Hap::MaxHttpSessions + 1];		// slot became ready while its worker was re-arming it
+		std::mutex mtx;	// protects client, sess, busy and again slots
+
+		// worker pool, not used when _workers == 0
+		std::thread worker[MaxWorkers];
+		std::mutex qmtx;
+		std::condition_variable qcv;
+		uint32_t queue[Hap::MaxHttpSessions + 1];	// ready slots, each slot is queued at most once
+		unsigned qhead = 0;
+		unsigned qlen = 0;
+
+		// epoll events of client with session sid
+		//	edge-triggered EPOLLOUT is reported only when the socket drains, so it is
+		//	always set; one-shot socket would report it right on re-arm, so in worker mode
+		//	it is set only while the session has queued output
+		uint32_t clientEvents(Hap::sid_t sid)
+		{
+			uint32_t events = EPOLLIN | EPOLLRDHUP | EPOLLET;
+			if (_workers == 0)
+				events |= EPOLLOUT;
+			else
+			{
+				events |= EPOLLONESHOT;
+				if (sid != sid_invalid && _http->Pending(sid))
+					events |= EPOLLOUT;
+			}
+			return events;
+		}
 
-		void run()
+		// re-arm one-shot socket sd in slot i, called by the slot owner
+		//	if the socket became ready after the last check the event is reported right away
+		bool arm(unsigned i, int sd, Hap::sid_t sid)
 		{
-			Log("Tcp::Run - enter\n");
+			struct epoll_event ev;
+			ev.events = clientEvents(sid);
+			ev.data.u32 = i;
+			if (::epoll_ctl(ep, EPOLL_CTL_MOD, sd, &ev) < 0)
+			{
+				Log("epoll_ctl(MOD, %d) error %s\n", sd, strerror(errno));
+				return false;
+			}
+			return true;
+		}
+
+		// send without blocking, returns 0 when the socket is full
+		static int send(int sd, char* buf, uint16_t len)
+		{
+			if (buf == nullptr)
+				return 0;
 
+			int rc = ::send(sd, buf, len, MSG_NOSIGNAL | MSG_DONTWAIT);
+			if (rc < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+				return 0;
+			return rc;
+		}
+
+		// accept all pending connections (server socket is non-blocking)
+		void accept()
+		{
 			struct sockaddr_in address;
-			size_t addrlen = sizeof(address);
+			socklen_t addrlen = sizeof(address);
 
-			while (running)
+			while (true)
 			{
-				int nfds = 0;
-				fd_set readfds;
-				FD_ZERO(&readfds);
+				int clnt = ::accept(server, (struct sockaddr *)&address, &addrlen);
+				if (clnt < 0)
+				{
+					if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+						Log("accept error %s\n", strerror(errno));
+					if (errno == EINTR)
+						continue;
+					break;
+				}
+
+				Log("Connection on socket %d from ip %s  port %d\n", clnt,
+					::inet_ntoa(address.sin_addr), ntohs(address.sin_port));
 
-				FD_SET(server, &readfds);
-				nfds = server + 1;
+				// responses and events are coalesced by Http::Server, Nagle only delays them
+				int one = 1;
+				if (::setsockopt(clnt, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one)) < 0)
+					Log("setsockopt(%d, TCP_NODELAY) failed: %s\n", clnt, strerror(errno));
 
-				for (unsigned i = 0; i < sizeofarr(client); i++)
+				std::lock_guard<std::mutex> lock(mtx);
+
+				// find free slot
+				unsigned i;
+				for (i = 0; i < sizeofarr(client); i++)
 				{
-					int sd = client[i];
-					if (sd > 0)
-					{
-						FD_SET(sd, &readfds);
-						if (sd >= nfds)
-							nfds = sd + 1;
-					}
+					if (client[i] == 0)
+						break;
 				}
 
-				Dbg("Tcp::Run - select\n");
-				timeval to = { 1, 0 };
-				int rc = ::select(nfds, &readfds, NULL, NULL, &to);
-				Dbg("Tcp::Run - select: %d\n", rc);
-				if (rc < 0)
+				if (i >= sizeofarr(client))
 				{
-					Log("select error %s\n", strerror(errno));
+					Log("Too many connections, close socket %d\n", clnt);
+					::close(clnt);
+					continue;
 				}
 
-				if (rc == 0)
+				client[i] = clnt;
+				sess[i] = sid_invalid;
+				busy[i] = false;
+				again[i] = false;
+
+				struct epoll_event ev;
+				ev.events = clientEvents(sid_invalid);
+				ev.data.u32 = i;
+				if (::epoll_ctl(ep, EPOLL_CTL_ADD, clnt, &ev) < 0)
 				{
-					// timeout, process events
-					for (unsigned i = 0; i < sizeofarr(client); i++)
-					{
-						int sd = client[i];
-						if (sd == 0)
-							continue;
+					Log("epoll_ctl(ADD, %d) error %s\n", clnt, strerror(errno));
+					::close(clnt);
+					client[i] = 0;
+					continue;
+				}
+			}
+		}
+
+		// disconnect client in slot i
+		void disconnect(unsigned i)
+		{
+			std::lock_guard<std::mutex> lock(mtx);
+
+			int sd = client[i];
+			struct sockaddr_in address;
+			socklen_t addrlen = sizeof(address);
+
+			if (::getpeername(sd, (struct sockaddr*)&address, &addrlen) == 0)
+				Log("Disconnect socket %d to ip %s  port %d\n", sd,
+					::inet_ntoa(address.sin_addr), ntohs(address.sin_port));
+			else
+				Log("Disconnect socket %d\n", sd);
+
+			::epoll_ctl(ep, EPOLL_CTL_DEL, sd, NULL);
+			::close(sd);
+			client[i] = 0;
+
+			if (sess[i] != sid_invalid)
+				_http->Close(sess[i]);
+			sess[i] = sid_invalid;
+			busy[i] = false;
+			again[i] = false;
+		}
+
+		// read event on client socket - data or disconnect
+		//	edge-triggered: keep processing while the socket has unread data,
+		//	no further notification will arrive for data that is already queued;
+		//	while output is queued the rest waits for EPOLLOUT, Process would not read it
+		//	returns false if the client was disconnected
+		bool process(unsigned i)
+		{
+			int sd = client[i];
+
+			do
+			{
+				bool close = false;
+				Hap::sid_t sid = sess[i];
 
-						Hap::sid_t sid = sess[i];
-						if (sid == Hap::sid_invalid)
-							continue;
+				Dbg("Tcp::Run - data from %d\n", sd);
 
-						Dbg("Tcp::Run - poll sid %d\n", sid);
+				if (sid == Hap::sid_invalid)
+				{
+					sid = _http->Open();
 
-						_http->Poll(sid, [sd](Hap::sid_t sid, char* buf, uint16_t len) -> int
+					std::lock_guard<std::mutex> lock(mtx);
+					sess[i] = sid;
+				}
+
+				if (sid == Hap::sid_invalid)
+				{
+					Log("Cannot open HTTP session for client %d\n", i);
+					close = true;
+				}
+				else
+				{
+					// reads never wait, partially received request is kept by Http::Server
+					//	and continued on next read event
+					bool rc = _http->Process(sid,
+						[sd](Hap::sid_t sid, char* buf, uint16_t size) -> int
+						{
+							int rc = ::recv(sd, buf, size, MSG_DONTWAIT);
+							if (rc < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+								return Hap::Http::Server::RecvAgain;
+							return rc;
+						},
+						[sd](Hap::sid_t sid, char* buf, uint16_t len) -> int
 						{
-							if (buf != nullptr)
-								return ::send(sd, buf, len, 0);
-							return 0;
-						});
+							return send(sd, buf, len);
+						}
+					);
+
+					if (!rc)
+					{
+						Log("HTTP Disconnect\n");
+						close = true;
 					}
 				}
 
-				// read event on server socket - incoming connection
-				if (FD_ISSET(server, &readfds))
+				if (close)
 				{
-					Dbg("Tcp::Run - accept %d\n", server);
+					disconnect(i);
+					return false;
+				}
+
+			} while (pending(sd) && !_http->Pending(sess[i]));
+
+			return true;
+		}
 
-					int clnt = ::accept(server, (struct sockaddr *)&address, &addrlen);
-					if (clnt < 0)
+		// queue ready client slot to worker threads
+		void dispatch(uint32_t slot)
+		{
+			std::lock_guard<std::mutex> lock(qmtx);
+
+			queue[(qhead + qlen) % sizeofarr(queue)] = slot;
+			qlen++;
+			qcv.notify_one();
+		}
+
+		// worker thread - process queued client slots
+		void work()
+		{
+			while (true)
+			{
+				uint32_t slot;
+				{
+					std::unique_lock<std::mutex> lock(qmtx);
+					qcv.wait(lock, [this]() { return !running || qlen > 0; });
+
+					if (!running)
+						break;
+
+					slot = queue[qhead];
+					qhead = (qhead + 1) % sizeofarr(queue);
+					qlen--;
+				}
+
+				while (process(slot))
+				{
+					int sd;
+					Hap::sid_t sid;
 					{
-						Log("accept error\n");
+						std::lock_guard<std::mutex> lock(mtx);
+						sd = client[slot];
+						sid = sess[slot];
 					}
-					else
+
+					// events for this session were skipped while it was being processed,
+					//	then re-arm one-shot socket, with EPOLLOUT if output is queued
+					poll(sd, sid);
+					if (!arm(slot, sd, sid))
 					{
-						Log("Connection on socket %d from ip %s  port %d\n", clnt,
-							::inet_ntoa(address.sin_addr), ntohs(address.sin_port));
+						disconnect(slot);
+						break;
+					}
 
-						//add new socket to array of sockets
-						for (unsigned i = 0; i < sizeofarr(client); i++)
+					// the slot is released, unless it became ready again after re-arm
+					{
+						std::lock_guard<std::mutex> lock(mtx);
+						if (!again[slot])
 						{
-							if (client[i] == 0)
-							{
-								client[i] = clnt;
-								break;
-							}
+							busy[slot] = false;
+							break;
 						}
+						again[slot] = false;
 					}
 				}
+			}
+		}
 
-				// read event on client socket - data or disconnect
-				for (unsigned i = 0; i < sizeofarr(client); i++)
+		// returns true if socket has unread data or is closed by peer
+		static bool pending(int sd)
+		{
+			char c;
+			return ::recv(sd, &c, 1, MSG_PEEK | MSG_DONTWAIT) >= 0;
+		}
+
+		// send pending events to client sd with session sid, called by the slot owner
+		void poll(int sd, Hap::sid_t sid)
+		{
+			if (sd == 0 || sid == Hap::sid_invalid)
+				return;
+
+			Dbg("Tcp::Run - poll sid %d\n", sid);
+
+			_http->Poll(sid, [sd](Hap::sid_t sid, char* buf, uint16_t len) -> int
+			{
+				return send(sd, buf, len);
+			});
+		}
+
+		// event notification, send pending events to all clients
+		void poll()
+		{
+			uint64_t cnt;
+			if (::read(evfd, &cnt, sizeof(cnt)) < 0)
+				return;
+
+			// sessions that are being processed by workers are polled by the worker,
+			//	the lock is held only to take the slot, so workers are not delayed by the fan-out
+			for (unsigned i = 0; i < sizeofarr(client); i++)
+			{
+				int sd;
+				Hap::sid_t sid;
 				{
-					int sd = client[i];
+					std::lock_guard<std::mutex> lock(mtx);
+					if (busy[i])
+						continue;
+					sd = client[i];
+					sid = sess[i];
+				}
 
-					if (FD_ISSET(sd, &readfds))
-					{
-						bool close = false;
-						Hap::sid_t sid = sess[i];
+				if (sd == 0 || sid == sid_invalid)
+					continue;
 
-						Dbg("Tcp::Run - data from %d\n", sd);
+				poll(sd, sid);
 
-						if (sid == Hap::sid_invalid)
-						{
-							sid = _http->Open();
-							sess[i] = sid;
-						}
+				// one-shot socket waits for EPOLLOUT when the events did not fit the socket
+				if (_workers > 0 && _http->Pending(sid))
+					arm(i, sd, sid);
+			}
+		}
 
-						if (sid == Hap::sid_invalid)
-						{
-							Log("Cannot open HTTP session for client %d\n", i);
-							close = true;
-						}
-						else
+		// wake up the run loop
+		void signal()
+		{
+			uint64_t one = 1;
+			if (::write(evfd, &one, sizeof(one)) < 0)
+				Log("eventfd write error %s\n", strerror(errno));
+		}
+
+		void run()
+		{
+			Log("Tcp::Run - enter\n");
+
+			while (running)
+			{
+				struct epoll_event events[MaxEvents];
+
+				Dbg("Tcp::Run - epoll_wait\n");
+				int rc = ::epoll_wait(ep, events, MaxEvents, -1);
+				Dbg("Tcp::Run - epoll_wait: %d\n", rc);
+				if (rc < 0)
+				{
+					if (errno != EINTR)
+						Log("epoll_wait error %s\n", strerror(errno));
+					continue;
+				}
+
+				for (int n = 0; n < rc && running; n++)
+				{
+					uint32_t slot = events[n].data.u32;
+
+					if (slot == ServerSlot)
+					{
+						// read event on server socket - incoming connection
+						Dbg("Tcp::Run - accept %d\n", server);
+						accept();
+					}
+					else if (slot == EventSlot)
+					{
+						poll();
+					}
+					else if (slot < sizeofarr(client) && _workers > 0)
+					{
+						// in worker mode errors are detected by the worker on next recv
+						//	the worker may still be releasing the slot it has just re-armed,
+						//	then it processes the slot again instead
+						bool queue = false;
 						{
-							bool rc = _http->Process(sid,
-								[sd](Hap::sid_t sid, char* buf, uint16_t size) -> int
-								{
-									return ::recv(sd, buf, size, 0);
-								},
-								[sd](Hap::sid_t sid, char* buf, uint16_t len) -> int
-								{
-									if (buf != nullptr)
-										return ::send(sd, buf, len, 0);
-									return 0;
-								}
-							);
-
-							if (!rc)
+							std::lock_guard<std::mutex> lock(mtx);
+							if (client[slot] != 0)
 							{
-								Log("HTTP Disconnect\n");
-								close = true;
+								queue = !busy[slot];
+								if (queue)
+									busy[slot] = true;
+								else
+									again[slot] = true;
 							}
 						}
 
-						if (close)
+						if (queue)
+							dispatch(slot);
+					}
+					else if (slot < sizeofarr(client) && client[slot] != 0)
+					{
+						if (events[n].events & (EPOLLERR | EPOLLHUP))
+							disconnect(slot);
+						else if (process(slot))
 						{
-							::getpeername(sd, (struct sockaddr*)&address, &addrlen);
-							Log("Disconnect socket %d to ip %s  port %d\n", sd,
-								::inet_ntoa(address.sin_addr), ntohs(address.sin_port));
-
-							::close(sd);
-							client[i] = 0;
-							_http->Close(sid);
-							sess[i] = sid_invalid;
+							// events are skipped while the session has partially received request
+							poll(client[slot], sess[slot]);
 						}
 					}
 				}
 			}
 
+			// stop workers first, so no slot is in use while remaining clients are disconnected
+			for (unsigned i = 0; i < _workers; i++)
+			{
+				if (worker[i].joinable())
+					worker[i].join();
+			}
+
 			for (unsigned i = 0; i < sizeofarr(client); i++)
 			{
-				int sd = client[i];
-				if (sd != 0)
-				{
-					::close(sd);
-					client[i] = 0;
-				}
+				if (client[i] != 0)
+					disconnect(i);
 			}
 
 			Log("Tcp::Run - exit\n");
@@ -211,8 +489,14 @@ namespace Hap
 		TcpImpl()
 		{
 			server = 0;
+			ep = -1;
+			evfd = -1;
 			for (unsigned i = 0; i < sizeofarr(client); i++)
+			{
 				client[i] = 0;
+				busy[i] = false;
+				again[i] = false;
+			}
 		}
 
 		~TcpImpl()
@@ -226,10 +510,12 @@ namespace Hap
 			{
 				client[i] = 0;
 				sess[i] = sid_invalid;
+				busy[i] = false;
+				again[i] = false;
 			}
 
 			//create the server socket
-			server = ::socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+			server = ::socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, IPPROTO_TCP);
 			if (server < 0)
 			{
 				Log("server socket creation failed\n");
@@ -265,27 +551,86 @@ namespace Hap
 				return false;
 			}
 
+			// create epoll instance and event notification
+			ep = ::epoll_create1(EPOLL_CLOEXEC);
+			if (ep < 0)
+			{
+				Log("epoll_create1 failed: %s\n", strerror(errno));
+				return false;
+			}
+
+			evfd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+			if (evfd < 0)
+			{
+				Log("eventfd failed: %s\n", strerror(errno));
+				return false;
+			}
+
+			struct epoll_event ev;
+			ev.events = EPOLLIN | EPOLLET;
+			ev.data.u32 = ServerSlot;
+			if (::epoll_ctl(ep, EPOLL_CTL_ADD, server, &ev) < 0)
+			{
+				Log("epoll_ctl(ADD, server) failed: %s\n", strerror(errno));
+				return false;
+			}
+
+			ev.events = EPOLLIN;
+			ev.data.u32 = EventSlot;
+			if (::epoll_ctl(ep, EPOLL_CTL_ADD, evfd, &ev) < 0)
+			{
+				Log("epoll_ctl(ADD, eventfd) failed: %s\n", strerror(errno));
+				return false;
+			}
+
+			_http->onEvent([this]() { signal(); });
+
 			running = true;
 			task = std::thread(&TcpImpl::run, this);
 
+			qhead = 0;
+			qlen = 0;
+			for (unsigned i = 0; i < _workers; i++)
+				worker[i] = std::thread(&TcpImpl::work, this);
+
 			return running;
 		}
 
 		virtual void Stop() override
 		{
-			running = false;
-
-			::close(server);
+			{
+				std::lock_guard<std::mutex> lock(qmtx);
+				running = false;
+				qcv.notify_all();
+			}
 
+			// the run loop joins the workers before it disconnects remaining clients
 			if (task.joinable())
+			{
+				signal();
 				task.join();
+			}
+
+			if (_http != nullptr)
+				_http->onEvent(nullptr);
+
+			if (server > 0)
+				::close(server);
+			if (evfd >= 0)
+				::close(evfd);
+			if (ep >= 0)
+				::close(ep);
+			server = 0;
+			evfd = -1;
+			ep = -1;
 		}
 
 	} tcp;
 
-	Tcp* Tcp::Create(Hap::Http::Server* http)
+	Tcp* Tcp::Create(Hap::Http::Server* http, unsigned workers)
 	{
 		tcp._http = http;
+		tcp._workers = workers < TcpImpl::MaxWorkers ? workers : TcpImpl::MaxWorkers;
 		return &tcp;
 	}
 }
@@ -258,6 +258,9 @@ public:
 		// assign instance IDs
 		myAcc.setId(aid);
 
+		// build characteristics index
+		Index();
+
 		// config AIS
 		myAis.config();
 	}
@@ -279,6 +282,8 @@ public:
 		if (f == NULL)
 			return false;
 
+		std::lock_guard<std::mutex> lock(_mtx);
+
 		char* key = new char[Hap::Controller::KeyLen * 2 + 1];
 
 		bool comma = false;
@@ -358,6 +363,50 @@ public:
 	}
 };
 
+// SRP salt and verifier of the setup code
+
+class MySrp : public Hap::Srp::Verifier
+{
+public:
+	bool Restore(const char* code, int code_len, const char* salt, int salt_len, const char* v, int v_len)
+	{
+		if (code_len > CodeSize)
+			return false;
+		if (salt_len != SaltSize * 2)
+			return false;
+		if (v_len == 0 || v_len > MaxSize * 2 || (v_len & 1) != 0)
+			return false;
+
+		memcpy(_code, code, code_len);
+		_code[code_len] = 0;
+		hex2bin(salt, _salt, SaltSize);
+		hex2bin(v, _v, v_len / 2);
+		_size = v_len / 2;
+
+		return true;
+	}
+
+	bool Save(FILE* f)
+	{
+		if (f == NULL)
+			return false;
+
+		char* s = new char[MaxSize * 2 + 1];
+
+		fprintf(f, "\t\t \"%s\"\n", _code);
+
+		bin2hex(_salt, SaltSize, s);
+		fprintf(f, "\t\t,\"%s\"\n", s);
+
+		bin2hex(_v, _size, s);
+		fprintf(f, "\t\t,\"%s\"\n", s);
+
+		delete[] s;
+
+		return true;
+	}
+};
+
 // configuration data of this accessory server
 //	implements save/restore to/from persistent storage 
 class MyConfig : public Hap::Config
@@ -365,6 +414,7 @@ class MyConfig : public Hap::Config
 public:
 	MyPairings pairings;
 	MyCrypto keys;
+	MySrp srp;
 
 	MyConfig(const char* fileName)
 		: _fileName(fileName)
@@ -419,6 +469,7 @@ private:
 
 		pairings.Reset();
 		keys.Reset();
+		srp.Init(setupCode);
 	}
 
 	virtual void _reset() override
@@ -433,6 +484,7 @@ private:
 
 		pairings.Reset();
 		keys.Reset();
+		srp.Init(setupCode);
 	}
 
 	virtual bool _save() override
@@ -461,6 +513,9 @@ private:
 		fprintf(f, "\t\"%s\":[\n", key[key_keys]);
 		keys.Save(f);
 		fprintf(f, "\t],\n");
+		fprintf(f, "\t\"%s\":[\n", key[key_srp]);
+		srp.Save(f);
+		fprintf(f, "\t],\n");
 		fprintf(f, "\t\"%s\":[\n", key[key_pairings]);
 		pairings.Save(f);
 		fprintf(f, "\t]\n");
@@ -494,13 +549,14 @@ private:
 			{ key[key_setup], Hap::Json::JSMN_STRING | Hap::Json::JSMN_UNDEFINED },
 			{ key[key_port], Hap::Json::JSMN_STRING | Hap::Json::JSMN_UNDEFINED },
 			{ key[key_keys], Hap::Json::JSMN_ARRAY | Hap::Json::JSMN_UNDEFINED },
+			{ key[key_srp], Hap::Json::JSMN_ARRAY | Hap::Json::JSMN_UNDEFINED },
 			{ key[key_pairings], Hap::Json::JSMN_ARRAY | Hap::Json::JSMN_UNDEFINED },
 			{ key[key_db], Hap::Json::JSMN_ARRAY | Hap::Json::JSMN_UNDEFINED },
 		};
 		bool ret = false;
 		char* b = nullptr;
 		long size = 0;
-		Hap::Json::Parser<100> js;
+		Hap::Json::Parser<64 + Hap::MaxPairings * 4> js;
 		int rc;
 
 		if (fseek(f, 0, SEEK_END) == 0)
@@ -598,6 +654,17 @@ private:
 				else
 					keys.Reset();
 				break;
+			case key_srp:
+				// srp array contains setup code, salt and verifier
+				if (js.size(i) == 3)
+				{
+					int k1 = js.find(i, 0);
+					int k2 = js.find(i, 1);
+					int k3 = js.find(i, 2);
+					if (srp.Restore(js.start(k1), js.length(k1), js.start(k2), js.length(k2), js.start(k3), js.length(k3)))
+						Log("Config: restore srp verifier for '%.*s'\n", js.length(k1), js.start(k1));
+				}
+				break;
 			case key_pairings:
 				pairings.Reset();
 				for (int k = 0; k < js.size(i); k++)
@@ -624,6 +691,10 @@ private:
 			}
 		}
 
+		// setup code changed or verifier not saved yet
+		if (!srp.Valid(setupCode))
+			srp.Init(setupCode);
+
 		ret = true;
 
 	Ret:
@@ -641,31 +712,32 @@ private:
 Hap::Config* Hap::config = &myConfig;
 
 // statically allocated storage for HTTP processing
-//	Our implementation is single-threaded so only one set of buffers.
-//	The http server uses this buffers only during processing a request.
+//	Sessions may be processed by several worker threads so each session gets its own set of buffers.
+//	The http server uses this buffers only during processing a request,
+//	except the output queue which keeps data the socket did not accept yet.
 //	All session-persistent data is kept in Session objects.
-Hap::BufStatic<char, Hap::MaxHttpFrame * 2> http_req;
-Hap::BufStatic<char, Hap::MaxHttpFrame * 4> http_rsp;
-Hap::BufStatic<char, Hap::MaxHttpFrame * 1> http_tmp;
-Hap::Http::Server::Buf buf = { http_req, http_rsp, http_tmp };
-Hap::Http::Server http(buf, db, myConfig.pairings, myConfig.keys);
+Hap::BufStatic<char, Hap::MaxHttpFrame * 4> http_req[Hap::MaxHttpSessions];
+Hap::BufStatic<char, Hap::MaxHttpFrame * 4> http_rsp[Hap::MaxHttpSessions];
+Hap::BufStatic<char, Hap::MaxHttpFrame * 1> http_tmp[Hap::MaxHttpSessions];
+Hap::BufStatic<char, Hap::MaxHttpFrame * 8> http_out[Hap::MaxHttpSessions];	// full response and queued events
+Hap::Http::Server::Buf buf[Hap::MaxHttpSessions];
+Hap::Http::Server http(buf, Hap::MaxHttpSessions, db, myConfig.pairings, myConfig.keys, myConfig.srp);
 
 bool Hap::debug = false;
 
+// shared memory name of server metrics, see -m option
+static const char* metricsName = "/hap-metrics";
+
 // random number generator
 extern "C" {
 	void t_stronginitrand()
 	{
-		srand((unsigned)time(NULL));
+		// Hap::Crypt::Random seeds itself from the system on first use
 	}
 
 	void t_random(unsigned char* data, unsigned size)
 	{
-
-		for (unsigned i = 0; i < size; i++)
-		{
-			*data++ = rand() & 0xFF;
-		}
+		Hap::Crypt::Random::Fill(data, size);
 	}
 }
 
@@ -676,13 +748,36 @@ int main(int argc, char* argv[])
 	bool reset = false;
 	app.add_flag("-R,--reset", reset, "Reset configuration");
 
+	unsigned workers = 0;
+	app.add_option("-w,--workers", workers, "Number of HTTP worker threads (0 - process in network thread)");
+
+	bool metrics = false;
+	app.add_flag("-m,--metrics", metrics, "Print metrics of running server and exit");
+
 	CLI11_PARSE(app, argc, argv);
 
+	if (metrics)
+	{
+		auto data = Hap::Metrics::Registry::Open(metricsName);
+		if (data == nullptr)
+		{
+			printf("Metrics %s not found\n", metricsName);
+			return 1;
+		}
+
+		Hap::Metrics::Registry::Print(*data);
+		return 0;
+	}
+
 	t_stronginitrand();
 
+	// assign per-session HTTP buffers
+	for (unsigned i = 0; i < sizeofarr(buf); i++)
+		buf[i] = { http_req[i], http_rsp[i], http_tmp[i], http_out[i] };
+
 	// create servers
 	Hap::Mdns* mdns = Hap::Mdns::Create();
-	Hap::Tcp* tcp = Hap::Tcp::Create(&http);
+	Hap::Tcp* tcp = Hap::Tcp::Create(&http, workers);
 
 	// restore configuration
 	myConfig.Init(reset);
@@ -715,6 +810,9 @@ int main(int argc, char* argv[])
 	db.Init(1);
 
 	// start servers
+	Hap::Metrics::Registry::Instance().Share(metricsName);
+	Hap::Logger::Instance().Start();
+	Hap::Crypt::KeyPool::Instance().Start();
 	mdns->Start();
 	tcp->Start();
 
@@ -730,6 +828,8 @@ int main(int argc, char* argv[])
 	// stop servers
 	tcp->Stop();
 	mdns->Stop();
+	Hap::Crypt::KeyPool::Instance().Stop();
+	Hap::Logger::Instance().Stop();
 
 	return 0;
 }
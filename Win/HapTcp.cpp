@@ -108,6 +108,11 @@ namespace Hap
 						Log("Connection on socket %d from ip %s  port %d\n", clnt,
 							inet_ntoa(address.sin_addr), ntohs(address.sin_port));
 
+						// responses are sent whole, Nagle only delays them
+						BOOL one = TRUE;
+						if (setsockopt(clnt, IPPROTO_TCP, TCP_NODELAY, (char*)&one, sizeof(one)) < 0)
+							Log("setsockopt(TCP_NODELAY) failed: %d\n", WSAGetLastError());
+
 						//add new socket to array of sockets 
 						for (int i = 0; i < sizeofarr(client); i++)
 						{
@@ -143,9 +148,15 @@ namespace Hap
 						}
 						else
 						{
+							// first read is satisfied by select, following reads are done only 
+							//	when data is queued, partially received request is kept by Http::Server
 							bool rc = _http->Process(sid,
-								[sd](Hap::sid_t sid, char* buf, uint16_t size) -> int
+								[sd, first = true](Hap::sid_t sid, char* buf, uint16_t size) mutable -> int
 								{
+									u_long avail = 0;
+									if (!first && ioctlsocket(sd, FIONREAD, &avail) == 0 && avail == 0)
+										return Hap::Http::Server::RecvAgain;
+									first = false;
 									return recv(sd, buf, size, 0);
 								},
 								[sd](Hap::sid_t sid, char* buf, uint16_t len) -> int
@@ -293,8 +304,9 @@ namespace Hap
 
 	} tcp;
 
-	Tcp* Tcp::Create(Hap::Http::Server* http)
+	Tcp* Tcp::Create(Hap::Http::Server* http, unsigned workers)
 	{
+		// all sessions are processed by the network thread, workers are not supported
 		tcp._http = http;
 		return &tcp;
 	}
@@ -156,6 +156,9 @@ public:
 		// assign instance IDs
 		myAcc.setId(aid);
 
+		// build characteristics index
+		Index();
+
 		// config AIS
 		myAis.config();
 	}
@@ -256,6 +259,50 @@ public:
 	}
 };
 
+// SRP salt and verifier of the setup code
+
+class MySrp : public Hap::Srp::Verifier
+{
+public:
+	bool Restore(const char* code, int code_len, const char* salt, int salt_len, const char* v, int v_len)
+	{
+		if (code_len > CodeSize)
+			return false;
+		if (salt_len != SaltSize * 2)
+			return false;
+		if (v_len == 0 || v_len > MaxSize * 2 || (v_len & 1) != 0)
+			return false;
+
+		memcpy(_code, code, code_len);
+		_code[code_len] = 0;
+		hex2bin(salt, _salt, SaltSize);
+		hex2bin(v, _v, v_len / 2);
+		_size = v_len / 2;
+
+		return true;
+	}
+
+	bool Save(FILE* f)
+	{
+		if (f == NULL)
+			return false;
+
+		char* s = new char[MaxSize * 2 + 1];
+
+		fprintf(f, "\t\t \"%s\"\n", _code);
+
+		bin2hex(_salt, SaltSize, s);
+		fprintf(f, "\t\t,\"%s\"\n", s);
+
+		bin2hex(_v, _size, s);
+		fprintf(f, "\t\t,\"%s\"\n", s);
+
+		delete[] s;
+
+		return true;
+	}
+};
+
 // configuration data of this accessory server
 //	implements save/restore to/from persistent storage 
 class MyConfig : public Hap::Config
@@ -263,6 +310,7 @@ class MyConfig : public Hap::Config
 public:
 	MyPairings pairings;
 	MyCrypto keys;
+	MySrp srp;
 
 	MyConfig(const char* fileName)
 		: _fileName(fileName)
@@ -317,6 +365,7 @@ private:
 
 		pairings.Reset();
 		keys.Reset();
+		srp.Init(setupCode);
 	}
 
 	virtual void _reset() override
@@ -331,6 +380,7 @@ private:
 
 		pairings.Reset();
 		keys.Reset();
+		srp.Init(setupCode);
 	}
 
 	virtual bool _save() override
@@ -359,6 +409,9 @@ private:
 		fprintf(f, "\t\"%s\":[\n", key[key_keys]);
 		keys.Save(f);
 		fprintf(f, "\t],\n");
+		fprintf(f, "\t\"%s\":[\n", key[key_srp]);
+		srp.Save(f);
+		fprintf(f, "\t],\n");
 		fprintf(f, "\t\"%s\":[\n", key[key_pairings]);
 		pairings.Save(f);
 		fprintf(f, "\t]\n");
@@ -392,12 +445,13 @@ private:
 			{ key[key_setup], Hap::Json::JSMN_STRING | Hap::Json::JSMN_UNDEFINED },
 			{ key[key_port], Hap::Json::JSMN_STRING | Hap::Json::JSMN_UNDEFINED },
 			{ key[key_keys], Hap::Json::JSMN_ARRAY | Hap::Json::JSMN_UNDEFINED },
+			{ key[key_srp], Hap::Json::JSMN_ARRAY | Hap::Json::JSMN_UNDEFINED },
 			{ key[key_pairings], Hap::Json::JSMN_ARRAY | Hap::Json::JSMN_UNDEFINED },
 		};
 		bool ret = false;
 		char* b = nullptr;
 		long size = 0;
-		Hap::Json::Parser<100> js;
+		Hap::Json::Parser<64 + Hap::MaxPairings * 4> js;
 		int rc;
 
 		if (fseek(f, 0, SEEK_END) == 0)
@@ -495,6 +549,17 @@ private:
 				else
 					keys.Reset();
 				break;
+			case key_srp:
+				// srp array contains setup code, salt and verifier
+				if (js.size(i) == 3)
+				{
+					int k1 = js.find(i, 0);
+					int k2 = js.find(i, 1);
+					int k3 = js.find(i, 2);
+					if (srp.Restore(js.start(k1), js.length(k1), js.start(k2), js.length(k2), js.start(k3), js.length(k3)))
+						Log("Config: restore srp verifier for '%.*s'\n", js.length(k1), js.start(k1));
+				}
+				break;
 			case key_pairings:
 				pairings.Reset();
 				for (int k = 0; k < js.size(i); k++)
@@ -519,6 +584,10 @@ private:
 			}
 		}
 
+		// setup code changed or verifier not saved yet
+		if (!srp.Valid(setupCode))
+			srp.Init(setupCode);
+
 		ret = true;
 
 	Ret:
@@ -539,11 +608,12 @@ Hap::Config* Hap::config = &myConfig;
 //	Our implementation is single-threaded so only one set of buffers.
 //	The http server uses this buffers only during processing a request.
 //	All session-persistend data is kept in Session objects.
-Hap::BufStatic<char, Hap::MaxHttpFrame * 2> http_req;
+Hap::BufStatic<char, Hap::MaxHttpFrame * 4> http_req;
 Hap::BufStatic<char, Hap::MaxHttpFrame * 4> http_rsp;
 Hap::BufStatic<char, Hap::MaxHttpFrame * 1> http_tmp;
-Hap::Http::Server::Buf buf = { http_req, http_rsp, http_tmp };
-Hap::Http::Server http(buf, db, myConfig.pairings, myConfig.keys);
+Hap::BufStatic<char, Hap::MaxHttpFrame * 5> http_out;
+Hap::Http::Server::Buf buf = { http_req, http_rsp, http_tmp, http_out };
+Hap::Http::Server http(buf, db, myConfig.pairings, myConfig.keys, myConfig.srp);
 
 template<typename T> bool is_number(int i, T& value)
 {
@@ -610,6 +680,9 @@ int main()
 
 #if 1
 	// start servers
+	Hap::Metrics::Registry::Instance().Share("HapMetrics");
+	Hap::Logger::Instance().Start();
+	Hap::Crypt::KeyPool::Instance().Start();
 	mdns->Start();
 	tcp->Start();
 
@@ -620,6 +693,8 @@ int main()
 	// stop servers
 	tcp->Stop();
 	mdns->Stop();
+	Hap::Crypt::KeyPool::Instance().Stop();
+	Hap::Logger::Instance().Stop();
 
 #else
 	Hap::sid_t sid = http.Open();
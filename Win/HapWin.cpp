@@ -31,85 +31,73 @@ SOFTWARE.
 #include <time.h>
 #include <stdlib.h>
 #include <stdarg.h>
+#include <windows.h>
 
-// HAP logging functions
-namespace Hap
-{
-	void Hex(const char* Header, const void* Buffer, size_t Length)
+#define Log Hap::Log
+
+// random number generator
+extern "C" {
+	void t_stronginitrand()
 	{
-		static const char hex[] = "0123456789ABCDEF";
-		const uint8_t* a = (const uint8_t*)Buffer;
-		size_t i;
-		size_t max = 16;
+		// Hap::Crypt::Random seeds itself from the system on first use
+	}
 
-		Log("%s addr %p size 0x%X(%d):\n", Header, Buffer, (unsigned)Length, (unsigned)Length);
+	void t_random(unsigned char* data, unsigned size)
+	{
+		Hap::Crypt::Random::Fill(data, size);
+	}
+}
 
-		while (Length > 0)
+// metrics in named file mapping
+namespace Hap
+{
+	namespace Metrics
+	{
+		bool Registry::Share(const char* name)
 		{
-			char line[52];
-			char *p = line;
-
-			if (Length < max)
-				max = Length;
-
-			memset(line, 0, sizeof(line));
-
-			for (i = 0; i < 16; i++)
+			// the handle stays open, the name exists while the mapping has open handles
+			HANDLE h = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, 0, sizeof(Data), name);
+			if (h == NULL)
 			{
-				if (i < max)
-				{
-					*p++ = hex[(a[i] & 0xf0) >> 4];
-					*p++ = hex[a[i] & 0x0f];
-				}
-				else
-				{
-					*p++ = ' ';
-					*p++ = ' ';
-				}
+				Log("Metrics: CreateFileMapping(%s) error %d\n", name, (int)GetLastError());
+				return false;
 			}
 
-			*p++ = ' ';
-			*p++ = ' ';
-			*p++ = ' ';
-
-			for (i = 0; i < max; i++)
+			void* p = MapViewOfFile(h, FILE_MAP_ALL_ACCESS, 0, 0, sizeof(Data));
+			if (p == NULL)
 			{
-				if (a[i] < 0x20 || a[i] > 0x7e) *p++ = '.';
-				else *p++ = a[i];
+				Log("Metrics: MapViewOfFile(%s) error %d\n", name, (int)GetLastError());
+				CloseHandle(h);
+				return false;
 			}
 
-			Log("0x%04lX:%s\n", (unsigned long)a & 0xFFFF, line);
+			Data* data = (Data*)p;
+			_copy(*data, *_data);
+			_data = data;
 
-			Length -= max;
-			a += max;
+			return true;
 		}
-	}
-
-	void Log(const char* f, ...)
-	{
-		va_list arg;
-		va_start(arg, f);
 
-		vprintf(f, arg);
-	}
-}
+		const Data* Registry::Open(const char* name)
+		{
+			HANDLE h = OpenFileMappingA(FILE_MAP_READ, FALSE, name);
+			if (h == NULL)
+				return nullptr;
 
-#define Log Hap::Log
+			void* p = MapViewOfFile(h, FILE_MAP_READ, 0, 0, sizeof(Data));
+			CloseHandle(h);
 
-// random number generator
-extern "C" {
-	void t_stronginitrand()
-	{
-		srand((unsigned)time(NULL));
-	}
+			if (p == NULL)
+				return nullptr;
 
-	void t_random(unsigned char* data, unsigned size)
-	{
+			const Data* data = (const Data*)p;
+			if (data->magic != Data::Magic || data->version != Data::Version || data->size != sizeof(Data))
+			{
+				UnmapViewOfFile(p);
+				return nullptr;
+			}
 
-		for (unsigned i = 0; i < size; i++)
-		{
-			*data++ = rand() & 0xFF;
+			return data;
 		}
 	}
 }
-